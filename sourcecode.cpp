@@ -3,7 +3,8 @@
 #include <cmath>
 #include <vector>
 #include <queue>
-#include <climits> // For INT_MAX
+#include <type_traits>
+#include <algorithm>
 #include <fstream>
 #include <stack>
 #include <sstream>
@@ -11,24 +12,83 @@
 #include <conio.h> // For _kbhit() and _getch() - Windows-specific
 #include <utility> // For std::move
 #include <limits>  // For std::numeric_limits
+#include <unordered_map>
+#include <map>
+#include <list>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <numeric>
+#include <random>
+#include <chrono>
+#include <cstdio>  // For std::rename, std::remove and FILE streams
+#include <charconv> // For std::to_chars
+#include <cstring>  // For strlen
+#ifdef _WIN32
+#include <io.h>     // For _commit
+#else
+#include <fcntl.h>  // For open
+#include <unistd.h> // For fsync
+#endif
+
+// x86 SIMD kernels for the dense all-pairs engine, selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MINPLUS_X86 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512vl")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define MINPLUS_X86 1
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
 
 using namespace std;
 using namespace sf;
 
 constexpr float PI = 3.14159265f;
-constexpr int MAX_V = 100;
+constexpr int MAX_V = 4000000;
 constexpr float ROUTER_RADIUS = 20.0f;
 constexpr float GRAPH_CENTER_X = 400.0f;
 constexpr float GRAPH_CENTER_Y = 300.0f;
 constexpr float GRAPH_RADIUS = 200.0f;
+constexpr size_t ROUTE_CACHE_BUDGET = 64 * 1024 * 1024; // Bytes of shortest-path trees kept cached
+constexpr int REFERENCE_BANDWIDTH = 100000; // Mbps; a link of this bandwidth has bandwidth cost 1
+// Largest weight of a weighted-sum metric term. A link then weighs at most 256 * 2^32 and a
+// simple path of under MAX_V links stays below 2^62, so path sums never overflow PathCost.
+constexpr int MAX_METRIC_WEIGHT = 256;
+constexpr int DELTA_STEPPING_MIN_LINKS = 200000; // Auto engine switches to delta-stepping from this size
+constexpr size_t DELTA_STEPPING_MAX_BUCKETS = 1 << 16; // Caps the cyclic bucket array
+constexpr size_t REPORT_LIST_LIMIT = 50; // Entries listed per section of the connectivity report
+constexpr double BETWEENNESS_CONFIDENCE_DELTA = 0.05; // Sampled betweenness bounds hold with 95% probability
+constexpr int BETWEENNESS_TOP = 10; // Routers and links listed in the criticality ranking
+constexpr int ORDER_PARTITION_BLOCK = 1024; // Partition ordering stops bisecting at this many routers
+constexpr int DENSE_APSP_TILE = 64;          // Routers per side of a Floyd-Warshall tile (32 KB of costs)
+constexpr int DENSE_APSP_MIN_ROUTERS = 64;   // Smaller topologies always use per-source searches
+constexpr int DENSE_APSP_MAX_ROUTERS = 4096; // Largest matrix: 128 MB of costs
+constexpr double DENSE_APSP_MIN_DENSITY = 0.1; // Fraction of possible links from which tables use the matrix
+constexpr size_t JOURNAL_COMPACT_ENTRIES = 10000; // Journal entries after which a new snapshot is written
+constexpr size_t EXPORT_BUFFER_BYTES = 4 << 20; // Formatted output a bulk-export thread collects per write
+
+// Accumulated path costs are 64-bit so long paths over large costs cannot overflow
+using PathCost = long long;
+constexpr PathCost INF_COST = numeric_limits<PathCost>::max(); // Unreachable
 
 // Represents an edge in the adjacency list
 struct EdgeNode {
     int dest;
-    int cost;
+    int cost;          // Latency in ms; kept unchanged while the link is DOWN
     EdgeNode* next;
-    int originalCost;
-    bool up;
+    bool up;           // Link state, independent of the cost
+    int bandwidth = 0; // Mbps, 0 if unknown
+    int lossBp = 0;    // Packet loss in basis points (1/100 of a percent)
+    EdgeNode* prev = nullptr; // Previous node in the owning router's list, for O(1) unlinking
+    EdgeNode* twin = nullptr; // Node for the opposite direction of the same link
+    int linkId = -1;          // Shared by both directions; indexes per-link masks and counters
 };
 
 // Represents a router (node) in the graph
@@ -53,7 +113,12 @@ struct Router {
     Router(const Router&) = delete;
     Router& operator=(const Router&) = delete;
 
-    Router& operator=(Router&& other) {
+    // Moves are needed so routers can live in a growing vector
+    Router(Router&& other) noexcept
+        : name(move(other.name)), up(other.up), head(other.head), x(other.x), y(other.y) {
+        other.head = nullptr;
+    }
+    Router& operator=(Router&& other) noexcept {
         if (this != &other) {
             EdgeNode* current = head;
             while (current != nullptr) {
@@ -75,22 +140,1334 @@ struct Router {
 
 // Struct to hold the results of Dijkstra's algorithm
 struct DijkstraResult {
-    vector<int> dist; // Shortest distance from source to each node
-    vector<int> prev; // Previous node in the shortest path
+    vector<PathCost> dist; // Shortest distance from source to each node (INF_COST if unreachable)
+    vector<int> prev;      // Previous node in the shortest path
+    vector<int> firstHop;  // First router after the source on the path to each node (-1 if none)
+
+    size_t memoryBytes() const {
+        return sizeof(DijkstraResult) + dist.capacity() * sizeof(PathCost)
+            + (prev.capacity() + firstHop.capacity()) * sizeof(int);
+    }
+};
+
+// Which link metrics route selection optimizes
+enum class RoutingMetric {
+    Latency,       // Sum of link costs (the default single metric)
+    WeightedSum,   // Weighted sum of latency, bandwidth cost and loss
+    Lexicographic  // Latency first, then loss, then bandwidth cost as tie-breakers
+};
+
+// Weights used by RoutingMetric::WeightedSum
+struct MetricWeights {
+    int latency = 1;
+    int bandwidth = 0;
+    int loss = 0;
+};
+
+// OSPF-style cost of a link's bandwidth: REFERENCE_BANDWIDTH / bandwidth, at least 1
+inline PathCost bandwidthCost(int bandwidth) {
+    if (bandwidth <= 0 || bandwidth >= REFERENCE_BANDWIDTH) return 1;
+    return REFERENCE_BANDWIDTH / bandwidth;
+}
+
+// Cost policies for the Dijkstra relaxation kernel. Each defines the distance type
+// accumulated along a path, the weight of one link, and the PathCost reported to callers.
+// The kernel is instantiated per policy, so the latency-only case compiles to the
+// same plain 64-bit additions as a dedicated implementation.
+struct LatencyCost {
+    using Dist = PathCost;
+    static Dist zero() { return 0; }
+    static Dist infinity() { return INF_COST; }
+    Dist weight(const EdgeNode* edge) const { return edge->cost; }
+    Dist extend(Dist d, const EdgeNode* edge) const { return d + weight(edge); }
+    static PathCost report(Dist d) { return d; }
+};
+
+struct WeightedSumCost {
+    using Dist = PathCost;
+    MetricWeights weights;
+    static Dist zero() { return 0; }
+    static Dist infinity() { return INF_COST; }
+    Dist weight(const EdgeNode* edge) const {
+        return (PathCost)weights.latency * edge->cost
+            + (PathCost)weights.bandwidth * bandwidthCost(edge->bandwidth)
+            + (PathCost)weights.loss * edge->lossBp;
+    }
+    Dist extend(Dist d, const EdgeNode* edge) const { return d + weight(edge); }
+    static PathCost report(Dist d) { return d; }
+};
+
+struct LexicographicCost {
+    struct Dist {
+        PathCost latency, loss, bandwidth;
+        Dist operator+(const Dist& o) const { return { latency + o.latency, loss + o.loss, bandwidth + o.bandwidth }; }
+        bool operator<(const Dist& o) const {
+            if (latency != o.latency) return latency < o.latency;
+            if (loss != o.loss) return loss < o.loss;
+            return bandwidth < o.bandwidth;
+        }
+        bool operator>(const Dist& o) const { return o < *this; }
+        bool operator==(const Dist& o) const { return !(*this < o) && !(o < *this); }
+        bool operator!=(const Dist& o) const { return !(*this == o); }
+    };
+    static Dist zero() { return { 0, 0, 0 }; }
+    static Dist infinity() { return { INF_COST, INF_COST, INF_COST }; }
+    Dist weight(const EdgeNode* edge) const { return { edge->cost, edge->lossBp, bandwidthCost(edge->bandwidth) }; }
+    Dist extend(Dist d, const EdgeNode* edge) const { return d + weight(edge); }
+    static PathCost report(Dist d) { return d.latency; } // Reported cost is the primary metric
+};
+
+// Widest (maximum-bottleneck) paths. Dist is the negated bottleneck bandwidth so the
+// same minimizing kernel applies; links of unknown bandwidth count as 0 Mbps.
+struct WidestCost {
+    using Dist = PathCost;
+    static Dist zero() { return -INF_COST; } // The source itself is not a bottleneck
+    static Dist infinity() { return INF_COST; }
+    Dist extend(Dist d, const EdgeNode* edge) const { return max(d, -(PathCost)edge->bandwidth); }
+    static PathCost report(Dist d) { return -d; } // Bottleneck bandwidth in Mbps
+};
+
+// Predecessor of a router at the hop layer where its best cost last improved
+struct HopStep {
+    int layer; // Links used by the improved route
+    int prev;  // Predecessor on that route
+    int older; // Step of the same router at an earlier layer, or -1
+};
+
+// Reusable buffers for one search at a time. Each thread running queries keeps its own,
+// so repeated queries do not reallocate and concurrent ones share no state.
+template <class Dist>
+struct SearchState {
+    vector<Dist> dist;
+    vector<int> prev;
+    vector<int> firstHop;
+    vector<bool> visited;
+    vector<pair<Dist, int>> heap;
+    vector<int> order; // Routers in the order they were settled
+    // Hop-limited search: best cost with at most 'layers' links (the next layer is built in
+    // nextLayerDist), and one HopStep per improvement, chained newest first from lastStep
+    vector<Dist> layerDist, nextLayerDist;
+    vector<HopStep> steps;
+    vector<int> lastStep;
+    vector<int> frontier, nextFrontier;
+    int layers = 0; // Hop layers computed by the last hop-limited search
+
+    void reset(int n, Dist infinity) {
+        dist.assign(n, infinity);
+        prev.assign(n, -1);
+        firstHop.assign(n, -1);
+        visited.assign(n, false);
+        heap.clear();
+        order.clear();
+    }
+};
+
+struct SearchWorkspace {
+    SearchState<PathCost> scalar;
+    SearchState<LexicographicCost::Dist> lexicographic;
+
+    template <class Dist>
+    SearchState<Dist>& state();
+};
+template <>
+inline SearchState<PathCost>& SearchWorkspace::state<PathCost>() { return scalar; }
+template <>
+inline SearchState<LexicographicCost::Dist>& SearchWorkspace::state<LexicographicCost::Dist>() { return lexicographic; }
+
+// Path query modes beyond the plain routing-metric shortest path
+enum class RouteMode {
+    Shortest, // Minimizes the selected routing metric
+    Widest    // Maximizes the bottleneck bandwidth
+};
+
+// A single path query. Exclusion masks apply to this query only, so concurrent
+// queries never touch the shared UP/DOWN flags.
+struct RouteQuery {
+    RouteMode mode = RouteMode::Shortest;
+    int maxHops = 0;                               // 0 = no hop limit
+    const vector<bool>* excludedRouters = nullptr; // Indexed by router index
+    const vector<bool>* excludedLinks = nullptr;   // Indexed by EdgeNode::linkId
+};
+
+struct RouteResult {
+    vector<int> path;        // Router indices from source to destination; empty if no route
+    PathCost cost = INF_COST; // Metric cost, or bottleneck bandwidth for RouteMode::Widest
+};
+
+// Links a plain search may traverse: the link and the router it leads to must be UP
+struct UpFilter {
+    const Router* nodes;
+    bool operator()(const EdgeNode* edge) const { return edge->up && nodes[edge->dest].up; }
+};
+
+// UpFilter plus a query's router and link exclusion masks
+struct LinkFilter {
+    const Router* nodes;
+    const vector<bool>* excludedRouters;
+    const vector<bool>* excludedLinks;
+
+    bool routerAllowed(int r) const {
+        return nodes[r].up && !(excludedRouters && r < (int)excludedRouters->size() && (*excludedRouters)[r]);
+    }
+    bool operator()(const EdgeNode* edge) const {
+        if (!edge->up || !routerAllowed(edge->dest)) return false;
+        return !(excludedLinks && edge->linkId < (int)excludedLinks->size() && (*excludedLinks)[edge->linkId]);
+    }
+};
+
+// Parses "latency", "lexicographic" or "weighted L B P" (also "weighted:L,B,P");
+// each weight must lie in [0, MAX_METRIC_WEIGHT]
+bool parseRoutingMetric(string text, RoutingMetric& metric, MetricWeights& weights) {
+    for (char& ch : text) {
+        if (ch == ':' || ch == ',') ch = ' ';
+    }
+    istringstream in(text);
+    string name;
+    in >> name;
+    weights = MetricWeights();
+    if (name == "latency") metric = RoutingMetric::Latency;
+    else if (name == "lexicographic") metric = RoutingMetric::Lexicographic;
+    else if (name == "weighted") {
+        metric = RoutingMetric::WeightedSum;
+        if (!(in >> weights.latency >> weights.bandwidth >> weights.loss)) return false;
+        for (int w : { weights.latency, weights.bandwidth, weights.loss }) {
+            if (w < 0 || w > MAX_METRIC_WEIGHT) return false;
+        }
+    }
+    else return false;
+    return true;
+}
+
+// Bounded cache of shortest-path trees keyed by source router and topology version.
+// Least recently used trees are evicted once the memory budget is exceeded.
+class RouteCache {
+public:
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+    };
+
+    explicit RouteCache(size_t budgetBytes = ROUTE_CACHE_BUDGET) : budget(budgetBytes) {}
+
+    // Returns the cached tree for 'src', or nullptr if absent or computed for another version
+    shared_ptr<const DijkstraResult> find(int src, unsigned long long version) {
+        auto it = index.find(src);
+        if (it == index.end() || it->second->version != version) {
+            if (it != index.end()) erase(it);
+            ++counters.misses;
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second); // Mark as most recently used
+        ++counters.hits;
+        return it->second->tree;
+    }
+
+    void insert(int src, unsigned long long version, shared_ptr<const DijkstraResult> tree) {
+        auto it = index.find(src);
+        if (it != index.end()) erase(it);
+        size_t bytes = tree->memoryBytes();
+        lru.push_front({ src, version, move(tree), bytes });
+        index[src] = lru.begin();
+        used += bytes;
+        // Always keep the newest tree, even if it alone exceeds the budget
+        while (used > budget && lru.size() > 1) {
+            erase(index.find(lru.back().src));
+            ++counters.evictions;
+        }
+    }
+
+    void clear() {
+        lru.clear();
+        index.clear();
+        used = 0;
+    }
+
+    const Stats& stats() const { return counters; }
+    size_t bytesUsed() const { return used; }
+    size_t size() const { return lru.size(); }
+
+private:
+    struct Entry {
+        int src;
+        unsigned long long version;
+        shared_ptr<const DijkstraResult> tree;
+        size_t bytes;
+    };
+
+    void erase(unordered_map<int, list<Entry>::iterator>::iterator it) {
+        used -= it->second->bytes;
+        lru.erase(it->second);
+        index.erase(it);
+    }
+
+    list<Entry> lru; // Most recently used first
+    unordered_map<int, list<Entry>::iterator> index;
+    size_t budget;
+    size_t used = 0;
+    Stats counters;
+};
+
+// Union-find over router indices, with union by size and path halving
+class DisjointSets {
+public:
+    void reset(int n) {
+        parent.resize(n);
+        iota(parent.begin(), parent.end(), 0);
+        size.assign(n, 1);
+    }
+    void add() {
+        parent.push_back((int)parent.size());
+        size.push_back(1);
+    }
+    int find(int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    }
+    // Read-only variant for const/concurrent callers; O(log n) thanks to union by size
+    int findRoot(int x) const {
+        while (parent[x] != x) x = parent[x];
+        return x;
+    }
+    bool unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) return false;
+        if (size[a] < size[b]) swap(a, b);
+        parent[b] = a;
+        size[a] += size[b];
+        return true;
+    }
+
+private:
+    vector<int> parent;
+    vector<int> size;
+};
+
+// Betweenness centrality: how many shortest paths between router pairs cross each
+// router and link. Equal-cost paths (ECMP) share a pair's weight equally.
+struct BetweennessResult {
+    vector<double> router; // Per router index, counting unordered pairs
+    vector<double> link;   // Per link id
+    int sources = 0;       // Sources searched; all UP routers for the exact computation
+    int upRouters = 0;
+    bool sampled = false;
+    // Sampled mode: with probability 1 - BETWEENNESS_CONFIDENCE_DELTA, every normalized
+    // router (link) score is within this distance of its exact value
+    double routerErrorBound = 0;
+    double linkErrorBound = 0;
+};
+
+// Links and routers whose failure would split their part of the network
+struct CriticalElements {
+    vector<int> bridges;            // Link ids
+    vector<int> articulationPoints; // Router indices
+};
+
+// Single-source shortest-path engines for building routing trees
+enum class SsspEngine {
+    Auto,         // Delta-stepping for large topologies on multi-core machines, else Dijkstra
+    Dijkstra,
+    DeltaStepping, // Parallel; additive scalar metrics only (falls back to Dijkstra otherwise)
+    DenseApsp      // Trees are rows of the all-pairs matrix; scalar metrics, up to DENSE_APSP_MAX_ROUTERS
+};
+
+// How routers are numbered inside the CSR snapshot. Router indices follow insertion
+// order, which scatters neighbors across memory; the other orders place routers that
+// are close in the graph close together in the arrays searches walk.
+enum class RouterOrder {
+    Insertion, // Same numbering as 'nodes'
+    Bfs,       // Breadth-first visiting order
+    Rcm,       // Reverse Cuthill-McKee: BFS from a peripheral router, low degrees first, reversed
+    Partition  // Recursive bisection into blocks of ORDER_PARTITION_BLOCK routers
+};
+
+// Compressed adjacency (CSR) snapshot of the UP part of the topology, for engines that
+// scan neighbors from many threads. Vertex i's usable links are entries
+// offsets[i] .. offsets[i + 1] - 1 of targets/weights/linkIds; links to or from DOWN
+// routers are left out. Both directions of each link are present.
+// Vertices may be renumbered (see RouterOrder): vertex k is router toExternal[k].
+struct CsrGraph {
+    vector<int> offsets;
+    vector<int> targets;
+    vector<PathCost> weights;
+    vector<int> linkIds;
+    PathCost maxWeight = 0;
+    vector<int> toExternal; // Empty when vertices are numbered like routers
+    vector<int> toInternal;
+
+    int vertexCount() const { return (int)offsets.size() - 1; }
+    size_t edgeCount() const { return targets.size(); }
+    int degree(int v) const { return offsets[v + 1] - offsets[v]; }
+    int internalId(int router) const { return toInternal.empty() ? router : toInternal[router]; }
+    int externalId(int v) const { return toExternal.empty() ? v : toExternal[v]; }
+
+    // Translates a tree computed on this snapshot back to router indices
+    void mapToExternal(DijkstraResult& result) const {
+        if (toExternal.empty() || result.dist.empty()) return;
+        int n = vertexCount();
+        DijkstraResult mapped;
+        mapped.dist.resize(n);
+        mapped.prev.resize(n);
+        mapped.firstHop.resize(n);
+        for (int v = 0; v < n; ++v) {
+            int router = toExternal[v];
+            mapped.dist[router] = result.dist[v];
+            mapped.prev[router] = result.prev[v] == -1 ? -1 : toExternal[result.prev[v]];
+            mapped.firstHop[router] = result.firstHop[v] == -1 ? -1 : toExternal[result.firstHop[v]];
+        }
+        result = move(mapped);
+    }
+};
+
+// Reusable thread barrier (std::barrier needs C++20)
+class Barrier {
+public:
+    explicit Barrier(int count) : threshold(count), remaining(count) {}
+
+    void arriveAndWait() {
+        unique_lock<mutex> lock(m);
+        size_t arrivedIn = generation;
+        if (--remaining == 0) {
+            ++generation;
+            remaining = threshold;
+            cv.notify_all();
+        }
+        else {
+            cv.wait(lock, [&] { return arrivedIn != generation; });
+        }
+    }
+
+private:
+    mutex m;
+    condition_variable cv;
+    int threshold;
+    int remaining;
+    size_t generation = 0;
+};
+
+// Number of worker threads to use when the caller asks for 0 (= one per hardware thread)
+inline int resolveThreadCount(int requested) {
+    if (requested > 0) return requested;
+    return max(1, (int)thread::hardware_concurrency());
+}
+
+// Picks the delta-stepping bucket width from the link cost distribution:
+// the maximum cost divided by the average degree (Meyer & Sanders), widened if
+// needed so the cyclic bucket array stays below DELTA_STEPPING_MAX_BUCKETS.
+PathCost autoTuneDelta(const CsrGraph& g) {
+    int n = g.vertexCount();
+    if (n <= 0 || g.edgeCount() == 0) return 1;
+    double averageDegree = (double)g.edgeCount() / n;
+    PathCost delta = max<PathCost>(1, (PathCost)(g.maxWeight / max(averageDegree, 1.0)));
+    PathCost minDelta = g.maxWeight / (PathCost)(DELTA_STEPPING_MAX_BUCKETS - 2) + 1;
+    return max(delta, minDelta);
+}
+
+// Position of every reached vertex in the order runDijkstra would settle it, given final
+// distances. Equal distances are settled by router index, except that a vertex reached
+// only over zero-cost links enters the queue when its zero-cost neighbor is settled.
+// Each distance class is replayed with an index-ordered queue seeded by the vertices
+// that a cheaper vertex already reached.
+vector<int> dijkstraSettleRanks(const CsrGraph& g, int src, const vector<PathCost>& dist) {
+    int n = g.vertexCount();
+    vector<int> order;
+    for (int v = 0; v < n; ++v) {
+        if (dist[v] != INF_COST) order.push_back(v);
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return dist[a] != dist[b] ? dist[a] < dist[b] : g.externalId(a) < g.externalId(b);
+    });
+    vector<int> rank(n, -1);
+    vector<pair<int, int>> queue; // (router index, vertex), min-heap
+    int settled = 0;
+    for (size_t begin = 0, end; begin < order.size(); begin = end) {
+        for (end = begin; end < order.size() && dist[order[end]] == dist[order[begin]]; ++end) {
+            int v = order[end];
+            bool seeded = v == src;
+            for (int e = g.offsets[v]; e < g.offsets[v + 1] && !seeded; ++e) {
+                int u = g.targets[e];
+                seeded = g.weights[e] > 0 && dist[u] != INF_COST && dist[u] + g.weights[e] == dist[v];
+            }
+            if (seeded) queue.push_back({ g.externalId(v), v });
+        }
+        make_heap(queue.begin(), queue.end(), greater<>());
+        while (!queue.empty()) {
+            pop_heap(queue.begin(), queue.end(), greater<>());
+            int v = queue.back().second;
+            queue.pop_back();
+            if (rank[v] != -1) continue;
+            rank[v] = settled++;
+            for (int e = g.offsets[v]; e < g.offsets[v + 1]; ++e) {
+                int u = g.targets[e];
+                if (g.weights[e] == 0 && rank[u] == -1) {
+                    queue.push_back({ g.externalId(u), u });
+                    push_heap(queue.begin(), queue.end(), greater<>());
+                }
+            }
+        }
+    }
+    return rank;
+}
+
+// Fills prev/firstHop of a result whose dist is final. Every router gets the neighbor
+// on a tight link (dist[u] + w == dist[v]) that runDijkstra would settle first, so the
+// tree is the one runDijkstra builds. Routers are processed in parallel; only
+// topologies with zero-cost links need the sequential settle ranks.
+void buildTreeFromDistances(const CsrGraph& g, int src, DijkstraResult& result, int threads) {
+    int n = g.vertexCount();
+    const vector<PathCost>& dist = result.dist;
+    result.prev.assign(n, -1);
+    result.firstHop.assign(n, -1);
+
+    vector<int> rank;
+    if (find(g.weights.begin(), g.weights.end(), 0) != g.weights.end()) {
+        rank = dijkstraSettleRanks(g, src, dist);
+    }
+    auto settlesBefore = [&](int a, int b) {
+        if (!rank.empty()) return rank[a] < rank[b];
+        return dist[a] != dist[b] ? dist[a] < dist[b] : g.externalId(a) < g.externalId(b);
+    };
+
+    auto worker = [&](int t) {
+        for (int v = t; v < n; v += threads) {
+            if (v == src || dist[v] == INF_COST) continue;
+            int best = -1;
+            for (int e = g.offsets[v]; e < g.offsets[v + 1]; ++e) {
+                int u = g.targets[e];
+                if (dist[u] == INF_COST || dist[u] + g.weights[e] != dist[v]) continue;
+                if (g.weights[e] == 0 && !settlesBefore(u, v)) continue; // Reached through v
+                if (best == -1 || settlesBefore(u, best)) best = u;
+            }
+            result.prev[v] = best;
+        }
+    };
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(worker, t);
+    worker(0);
+    for (thread& w : workers) w.join();
+
+    // First hops: walk up to the nearest router whose first hop is known, then fill the walk
+    vector<int> walk;
+    for (int v = 0; v < n; ++v) {
+        if (v == src || result.prev[v] == -1 || result.firstHop[v] != -1) continue;
+        int current = v;
+        while (current != src && result.prev[current] != src && result.firstHop[current] == -1) {
+            walk.push_back(current);
+            current = result.prev[current];
+        }
+        int hop = (current == src) ? -1 : (result.prev[current] == src ? current : result.firstHop[current]);
+        if (current != src) result.firstHop[current] = hop;
+        for (int w : walk) result.firstHop[w] = hop;
+        walk.clear();
+    }
+}
+
+// Parallel single-source shortest paths by delta-stepping over a CSR snapshot.
+// Distances fall into buckets of width 'delta'; each bucket is settled by repeatedly
+// relaxing its light links (cost <= delta) in parallel, then its heavy links once.
+// Relaxation is a lock-free atomic min on the distance. The result is the tree
+// runDijkstra builds: the same distances, predecessors and first hops.
+DijkstraResult deltaSteppingSssp(const CsrGraph& g, int src, PathCost delta, int threads) {
+    int n = g.vertexCount();
+    DijkstraResult result;
+    if (src < 0 || src >= n) return result;
+    threads = resolveThreadCount(threads);
+
+    vector<atomic<PathCost>> dist(n);
+    for (auto& d : dist) d.store(INF_COST, memory_order_relaxed);
+    dist[src].store(0, memory_order_relaxed);
+
+    // Cyclic bucket array: a relaxation from bucket i lands at most maxWeight / delta + 1
+    // buckets ahead, so that many slots (plus one) never alias live buckets
+    size_t bucketCount = (size_t)(g.maxWeight / delta) + 2;
+    vector<vector<int>> buckets(bucketCount);
+    buckets[0].push_back(src);
+    size_t current = 0; // Absolute index of the bucket being settled
+
+    vector<int> frontier;             // Routers to relax in the current round
+    vector<int> settled;              // Routers settled in the current bucket
+    vector<char> inFrontier(n, 0), inSettled(n, 0);
+    vector<vector<int>> outbox(threads); // Per-thread routers whose distance dropped
+    atomic<size_t> cursor(0);
+    bool done = false, heavyPhase = false;
+    Barrier barrier(threads);
+
+    // Relaxes the light or heavy links of the routers in 'list', claiming chunks of it
+    auto relaxList = [&](int t, const vector<int>& list, bool heavy) {
+        const size_t chunk = 64;
+        for (size_t begin = cursor.fetch_add(chunk); begin < list.size(); begin = cursor.fetch_add(chunk)) {
+            size_t end = min(begin + chunk, list.size());
+            for (size_t i = begin; i < end; ++i) {
+                int u = list[i];
+                PathCost du = dist[u].load(memory_order_relaxed);
+                for (int e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+                    PathCost w = g.weights[e];
+                    if ((w > delta) != heavy) continue;
+                    int v = g.targets[e];
+                    PathCost candidate = du + w;
+                    PathCost old = dist[v].load(memory_order_relaxed);
+                    while (candidate < old) {
+                        if (dist[v].compare_exchange_weak(old, candidate, memory_order_relaxed)) {
+                            outbox[t].push_back(v);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    };
+    // Moves every router whose distance dropped into the bucket of its new distance
+    auto mergeOutboxes = [&] {
+        for (vector<int>& box : outbox) {
+            for (int v : box) {
+                buckets[(size_t)(dist[v].load(memory_order_relaxed) / delta) % bucketCount].push_back(v);
+            }
+            box.clear();
+        }
+    };
+    // Single-threaded step between rounds: merges relaxed routers into their buckets,
+    // then picks the next round. Light rounds repeat until the current bucket stays
+    // empty, then one heavy round follows and the next non-empty bucket is started.
+    auto prepareRound = [&] {
+        mergeOutboxes();
+        cursor.store(0);
+        if (heavyPhase) {
+            heavyPhase = false;
+            for (int v : settled) inSettled[v] = 0;
+            settled.clear();
+            size_t scanned = 0;
+            do {
+                ++current;
+            } while (buckets[current % bucketCount].empty() && ++scanned < bucketCount);
+            if (buckets[current % bucketCount].empty()) {
+                done = true;
+                return;
+            }
+        }
+        // Take the live, not yet queued entries of the current bucket
+        frontier.clear();
+        vector<int>& bucket = buckets[current % bucketCount];
+        for (int v : bucket) {
+            if ((size_t)(dist[v].load(memory_order_relaxed) / delta) != current || inFrontier[v]) continue;
+            inFrontier[v] = 1;
+            frontier.push_back(v);
+            if (!inSettled[v]) {
+                inSettled[v] = 1;
+                settled.push_back(v);
+            }
+        }
+        bucket.clear();
+        for (int v : frontier) inFrontier[v] = 0;
+        if (frontier.empty()) heavyPhase = true; // Bucket is stable: relax its heavy links
+    };
+
+    auto worker = [&](int t) {
+        while (true) {
+            if (t == 0) prepareRound();
+            barrier.arriveAndWait();
+            if (done) break;
+            relaxList(t, heavyPhase ? settled : frontier, heavyPhase);
+            barrier.arriveAndWait();
+        }
+    };
+
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(worker, t);
+    worker(0);
+    for (thread& w : workers) w.join();
+
+    result.dist.resize(n);
+    for (int v = 0; v < n; ++v) result.dist[v] = dist[v].load(memory_order_relaxed);
+    buildTreeFromDistances(g, src, result, threads);
+    return result;
+}
+
+// Sequential Dijkstra over a CSR snapshot (vertex numbering, not router indices).
+// Neighbors are read from contiguous arrays, so a locality-preserving RouterOrder
+// keeps the dist/prev accesses of one search close together. Equal costs are settled
+// by router index, as in the adjacency-list search, so a renumbered snapshot picks
+// the same predecessors and next hops.
+DijkstraResult csrDijkstra(const CsrGraph& g, int src) {
+    struct Entry {
+        PathCost dist;
+        int router; // Tie-break key
+        int vertex;
+        bool operator>(const Entry& o) const { return dist != o.dist ? dist > o.dist : router > o.router; }
+    };
+    int n = g.vertexCount();
+    DijkstraResult result;
+    if (src < 0 || src >= n) return result;
+    result.dist.assign(n, INF_COST);
+    result.prev.assign(n, -1);
+    result.firstHop.assign(n, -1);
+    vector<char> visited(n, 0);
+    vector<Entry> heap;
+    result.dist[src] = 0;
+    heap.push_back({ 0, g.externalId(src), src });
+    while (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), greater<>());
+        int u = heap.back().vertex;
+        heap.pop_back();
+        if (visited[u]) continue;
+        visited[u] = 1;
+        PathCost du = result.dist[u];
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+            int v = g.targets[e];
+            PathCost candidate = du + g.weights[e];
+            if (!visited[v] && candidate < result.dist[v]) {
+                result.dist[v] = candidate;
+                result.prev[v] = u;
+                result.firstHop[v] = (u == src) ? v : result.firstHop[u];
+                heap.push_back({ candidate, g.externalId(v), v });
+                push_heap(heap.begin(), heap.end(), greater<>());
+            }
+        }
+    }
+    return result;
+}
+
+// Breadth-first search over the vertices whose label equals 'which', starting at
+// 'start'. Appends the visiting order to 'out'; vertices are marked in 'seen' with
+// 'stamp'. Returns the last vertex reached (a farthest one).
+int labelledBfs(const CsrGraph& g, int start, const vector<int>& label, int which,
+                vector<unsigned>& seen, unsigned stamp, vector<int>& out) {
+    size_t head = out.size();
+    out.push_back(start);
+    seen[start] = stamp;
+    while (head < out.size()) {
+        int u = out[head++];
+        for (int e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+            int v = g.targets[e];
+            if (seen[v] == stamp || label[v] != which) continue;
+            seen[v] = stamp;
+            out.push_back(v);
+        }
+    }
+    return out.back();
+}
+
+// Plain breadth-first order; each component starts at its lowest-numbered router
+vector<int> bfsOrder(const CsrGraph& g) {
+    int n = g.vertexCount();
+    vector<int> order, label(n, 0);
+    vector<unsigned> seen(n, 0);
+    order.reserve(n);
+    for (int v = 0; v < n; ++v) {
+        if (!seen[v]) labelledBfs(g, v, label, 0, seen, 1, order);
+    }
+    return order;
+}
+
+// Reverse Cuthill-McKee. Each component is started from a pseudo-peripheral router
+// (found by a double BFS sweep from a minimum-degree one) and its neighbors are
+// enqueued by increasing degree; reversing the whole order narrows the bandwidth further.
+vector<int> rcmOrder(const CsrGraph& g) {
+    int n = g.vertexCount();
+    vector<int> byDegree(n), order, sweep, label(n, 0);
+    vector<unsigned> seen(n, 0);
+    vector<char> placed(n, 0);
+    iota(byDegree.begin(), byDegree.end(), 0);
+    auto lowerDegree = [&](int a, int b) { return g.degree(a) < g.degree(b); };
+    stable_sort(byDegree.begin(), byDegree.end(), lowerDegree);
+    order.reserve(n);
+    unsigned stamp = 0;
+    for (int seed : byDegree) {
+        if (placed[seed]) continue;
+        sweep.clear();
+        int start = labelledBfs(g, seed, label, 0, seen, ++stamp, sweep);
+        sweep.clear();
+        start = labelledBfs(g, start, label, 0, seen, ++stamp, sweep);
+
+        size_t head = order.size();
+        order.push_back(start);
+        placed[start] = 1;
+        while (head < order.size()) {
+            int u = order[head++];
+            size_t first = order.size();
+            for (int e = g.offsets[u]; e < g.offsets[u + 1]; ++e) {
+                int v = g.targets[e];
+                if (placed[v]) continue;
+                placed[v] = 1;
+                order.push_back(v);
+            }
+            stable_sort(order.begin() + first, order.end(), lowerDegree);
+        }
+    }
+    reverse(order.begin(), order.end());
+    return order;
+}
+
+// Recursive bisection: a part is split into the first and second half of its
+// breadth-first order from a pseudo-peripheral router (a level-structure cut), until
+// parts fit in ORDER_PARTITION_BLOCK routers. Parts are emitted in recursion order,
+// each in BFS order, so every block and its sibling blocks are contiguous.
+vector<int> partitionOrder(const CsrGraph& g) {
+    int n = g.vertexCount();
+    vector<int> order, label(n, 0);
+    vector<unsigned> seen(n, 0);
+    unsigned stamp = 0;
+    int nextLabel = 1;
+    order.reserve(n);
+
+    vector<int> all(n);
+    iota(all.begin(), all.end(), 0);
+    vector<pair<vector<int>, int>> parts; // Stack of (members, label) still to place
+    parts.push_back({ move(all), 0 });
+    vector<int> levels, sweep;
+    while (!parts.empty()) {
+        vector<int> members = move(parts.back().first);
+        int which = parts.back().second;
+        parts.pop_back();
+
+        // Level order of the part; pieces not connected inside it follow one another.
+        // Halves list their routers starting from the end far from the cut, so only
+        // the whole topology needs a sweep to find peripheral starting routers.
+        levels.clear();
+        stamp += 2;
+        for (int v : members) {
+            if (seen[v] == stamp) continue;
+            int start = v;
+            if (which == 0) {
+                sweep.clear();
+                start = labelledBfs(g, v, label, which, seen, stamp - 1, sweep);
+            }
+            labelledBfs(g, start, label, which, seen, stamp, levels);
+        }
+
+        if ((int)levels.size() <= ORDER_PARTITION_BLOCK) {
+            order.insert(order.end(), levels.begin(), levels.end());
+            continue;
+        }
+        size_t half = levels.size() / 2;
+        int firstLabel = nextLabel++, secondLabel = nextLabel++;
+        for (size_t i = 0; i < levels.size(); ++i) label[levels[i]] = i < half ? firstLabel : secondLabel;
+        // The first half is placed first, so it goes on the stack last
+        parts.push_back({ vector<int>(levels.rbegin(), levels.rend() - half), secondLabel });
+        parts.push_back({ vector<int>(levels.begin(), levels.begin() + half), firstLabel });
+    }
+    return order;
+}
+
+// Computes the vertex order for 'order' (empty for RouterOrder::Insertion)
+vector<int> computeRouterOrder(const CsrGraph& g, RouterOrder order) {
+    switch (order) {
+    case RouterOrder::Bfs:       return bfsOrder(g);
+    case RouterOrder::Rcm:       return rcmOrder(g);
+    case RouterOrder::Partition: return partitionOrder(g);
+    default:                     return {};
+    }
+}
+
+// Renumbers a snapshot so that vertex k becomes order[k]'s router
+CsrGraph renumberCsr(const CsrGraph& g, const vector<int>& order) {
+    int n = g.vertexCount();
+    CsrGraph out;
+    out.maxWeight = g.maxWeight;
+    out.toExternal.resize(n);
+    out.toInternal.resize(n);
+    for (int k = 0; k < n; ++k) {
+        out.toExternal[k] = g.externalId(order[k]);
+        out.toInternal[out.toExternal[k]] = k;
+    }
+    vector<int> position(n);
+    for (int k = 0; k < n; ++k) position[order[k]] = k;
+    out.offsets.assign(n + 1, 0);
+    for (int k = 0; k < n; ++k) out.offsets[k + 1] = out.offsets[k] + g.degree(order[k]);
+    out.targets.resize(g.edgeCount());
+    out.weights.resize(g.edgeCount());
+    out.linkIds.resize(g.edgeCount());
+    for (int k = 0; k < n; ++k) {
+        int pos = out.offsets[k];
+        for (int e = g.offsets[order[k]]; e < g.offsets[order[k] + 1]; ++e, ++pos) {
+            out.targets[pos] = position[g.targets[e]];
+            out.weights[pos] = g.weights[e];
+            out.linkIds[pos] = g.linkIds[e];
+        }
+    }
+    return out;
+}
+
+// Average distance between the numbers of linked vertices; lower means neighbors
+// sit closer together in memory
+double averageLinkSpan(const CsrGraph& g) {
+    if (g.edgeCount() == 0) return 0;
+    double total = 0;
+    for (int v = 0; v < g.vertexCount(); ++v) {
+        for (int e = g.offsets[v]; e < g.offsets[v + 1]; ++e) total += abs(g.targets[e] - v);
+    }
+    return total / g.edgeCount();
+}
+
+bool parseRouterOrder(const string& text, RouterOrder& order) {
+    if (text == "none") order = RouterOrder::Insertion;
+    else if (text == "bfs") order = RouterOrder::Bfs;
+    else if (text == "rcm") order = RouterOrder::Rcm;
+    else if (text == "partition") order = RouterOrder::Partition;
+    else return false;
+    return true;
+}
+
+// Implementations of the min-plus row update used by the dense all-pairs engine
+enum class MinPlusKernel {
+    Scalar,
+    Avx2,   // 4 costs per instruction; 64-bit compare + blend (AVX2 has no 64-bit min)
+    Avx512  // 8 costs per instruction; 64-bit compare into a mask + masked blend
+};
+
+constexpr PathCost DENSE_INF = INF_COST / 4; // "Unreachable" in the matrix; two can be added safely
+
+// Relaxes one matrix row through pivot k: dRow[j] = min(dRow[j], dik + kRow[j])
+void relaxRowScalar(PathCost* dRow, const PathCost* kRow, PathCost dik, int count) {
+    for (int j = 0; j < count; ++j) {
+        dRow[j] = min(dRow[j], dik + kRow[j]);
+    }
+}
+
+#ifdef MINPLUS_X86
+TARGET_AVX2
+void relaxRowAvx2(PathCost* dRow, const PathCost* kRow, PathCost dik, int count) {
+    const __m256i vdik = _mm256_set1_epi64x(dik);
+    int j = 0;
+    for (; j + 4 <= count; j += 4) {
+        __m256i candidate = _mm256_add_epi64(vdik, _mm256_loadu_si256((const __m256i*)(kRow + j)));
+        __m256i current = _mm256_loadu_si256((const __m256i*)(dRow + j));
+        __m256i better = _mm256_cmpgt_epi64(current, candidate);
+        _mm256_storeu_si256((__m256i*)(dRow + j), _mm256_blendv_epi8(current, candidate, better));
+    }
+    relaxRowScalar(dRow + j, kRow + j, dik, count - j);
+}
+
+TARGET_AVX512
+void relaxRowAvx512(PathCost* dRow, const PathCost* kRow, PathCost dik, int count) {
+    const __m512i vdik = _mm512_set1_epi64(dik);
+    int j = 0;
+    for (; j + 8 <= count; j += 8) {
+        __m512i candidate = _mm512_add_epi64(vdik, _mm512_loadu_si512(kRow + j));
+        __m512i current = _mm512_loadu_si512(dRow + j);
+        __mmask8 better = _mm512_cmplt_epi64_mask(candidate, current);
+        _mm512_storeu_si512(dRow + j, _mm512_mask_blend_epi64(better, current, candidate));
+    }
+    relaxRowScalar(dRow + j, kRow + j, dik, count - j);
+}
+#endif
+
+// Best kernel the CPU (and OS, for the wide registers) supports
+MinPlusKernel detectMinPlusKernel() {
+#if defined(MINPLUS_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) return MinPlusKernel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return MinPlusKernel::Avx2;
+#elif defined(MINPLUS_X86)
+    int info[4];
+    __cpuid(info, 1);
+    bool osSavesAvx = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+    if (osSavesAvx) {
+        __cpuidex(info, 7, 0);
+        bool avx2 = info[1] & (1 << 5);
+        bool avx512 = (info[1] & (1 << 16)) && (info[1] & (1 << 31)) && (_xgetbv(0) & 0xE0) == 0xE0;
+        if (avx512) return MinPlusKernel::Avx512;
+        if (avx2) return MinPlusKernel::Avx2;
+    }
+#endif
+    return MinPlusKernel::Scalar;
+}
+
+using RelaxRowFn = void (*)(PathCost*, const PathCost*, PathCost, int);
+
+RelaxRowFn relaxRowFor(MinPlusKernel kernel) {
+#ifdef MINPLUS_X86
+    if (kernel == MinPlusKernel::Avx512) return relaxRowAvx512;
+    if (kernel == MinPlusKernel::Avx2) return relaxRowAvx2;
+#endif
+    return relaxRowScalar;
+}
+
+// All-pairs shortest paths as row-major matrices, padded to whole tiles
+struct DenseApsp {
+    int n = 0;
+    int stride = 0;        // Row length: n rounded up to a multiple of DENSE_APSP_TILE
+    bool usable = true;    // False if path costs could overflow DENSE_INF; the matrix is then empty
+    vector<PathCost> dist; // dist[i * stride + j]; DENSE_INF if unreachable
+
+    PathCost cost(int i, int j) const {
+        PathCost d = dist[(size_t)i * stride + j];
+        return d >= DENSE_INF ? INF_COST : d;
+    }
+
+    // Shortest-path tree of 'src' over snapshot 'g' (built with the same weights). The
+    // row gives the costs; predecessors and first hops are then picked in one pass over
+    // the links, exactly as runDijkstra would pick them among equal-cost paths.
+    DijkstraResult tree(const CsrGraph& g, int src) const {
+        DijkstraResult result;
+        result.dist.resize(n);
+        for (int v = 0; v < n; ++v) result.dist[v] = cost(src, g.externalId(v));
+        buildTreeFromDistances(g, g.internalId(src), result, 1);
+        g.mapToExternal(result);
+        return result;
+    }
+};
+
+// Cache-blocked Floyd-Warshall on a matrix whose dist holds the direct links.
+// For each pivot block: the diagonal tile is closed first, then the tiles in its row
+// and column, then every remaining tile, a min-plus product of one tile from each.
+// Tiles of a phase are independent and split round-robin over the threads.
+void solveDenseApsp(DenseApsp& m, MinPlusKernel kernel, int threads) {
+    RelaxRowFn relaxRow = relaxRowFor(kernel);
+    int blocks = m.stride / DENSE_APSP_TILE;
+    const int T = DENSE_APSP_TILE;
+    PathCost* dist = m.dist.data();
+    size_t stride = m.stride;
+
+    // Relaxes tile (bi, bj) through the pivots of block bk; k outermost so tiles that
+    // contain their own pivots stay correct
+    auto relaxTile = [&](int bi, int bj, int bk) {
+        for (int k = bk * T; k < (bk + 1) * T; ++k) {
+            const PathCost* kRow = dist + k * stride + bj * T;
+            for (int i = bi * T; i < (bi + 1) * T; ++i) {
+                PathCost dik = dist[i * stride + k];
+                if (dik >= DENSE_INF) continue;
+                relaxRow(dist + i * stride + bj * T, kRow, dik, T);
+            }
+        }
+    };
+
+    threads = max(1, min(resolveThreadCount(threads), blocks * blocks));
+    Barrier barrier(threads);
+    auto worker = [&](int t) {
+        for (int bk = 0; bk < blocks; ++bk) {
+            if (t == 0) relaxTile(bk, bk, bk);
+            barrier.arriveAndWait();
+            for (int b = t; b < 2 * blocks; b += threads) {
+                int other = b / 2;
+                if (other == bk) continue;
+                if (b % 2 == 0) relaxTile(bk, other, bk);
+                else relaxTile(other, bk, bk);
+            }
+            barrier.arriveAndWait();
+            for (int b = t; b < blocks * blocks; b += threads) {
+                int bi = b / blocks, bj = b % blocks;
+                if (bi != bk && bj != bk) relaxTile(bi, bj, bk);
+            }
+            barrier.arriveAndWait();
+        }
+    };
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(worker, t);
+    worker(0);
+    for (thread& w : workers) w.join();
+}
+
+// Kinds of operation that can appear in a topology change set
+enum class ChangeType {
+    AddRouter,
+    RemoveRouter,
+    AddLink,    // Adds a link, or updates the cost of an existing one
+    RemoveLink,
+    LinkUp,
+    LinkDown,
+    RouterUp,
+    RouterDown
+};
+
+// A single router/link operation of a change set, addressed by router names
+struct TopologyChange {
+    ChangeType type = ChangeType::AddRouter;
+    string from;  // Router name, or first endpoint of a link
+    string to;    // Second endpoint of a link (unused for router operations)
+    int cost = 0;       // Link cost for AddLink
+    int bandwidth = -1; // Link bandwidth for AddLink (-1 keeps the current value)
+    int lossBp = -1;    // Link loss for AddLink (-1 keeps the current value)
+    TopologyChange() {}
+    TopologyChange(ChangeType type, const string& from, const string& to = "",
+                   int cost = 0, int bandwidth = -1, int lossBp = -1)
+        : type(type), from(from), to(to), cost(cost), bandwidth(bandwidth), lossBp(lossBp) {}
+};
+
+using ChangeSet = vector<TopologyChange>;
+
+// Formats a change as one line of the change-set file format
+string formatChange(const TopologyChange& change) {
+    switch (change.type) {
+    case ChangeType::AddRouter:    return "add-router " + change.from;
+    case ChangeType::RemoveRouter: return "remove-router " + change.from;
+    case ChangeType::AddLink: {
+        string line = "add-link " + change.from + " " + change.to + " " + to_string(change.cost);
+        if (change.bandwidth >= 0 || change.lossBp >= 0) {
+            line += " " + to_string(change.bandwidth) + " " + to_string(change.lossBp);
+        }
+        return line;
+    }
+    case ChangeType::RemoveLink:   return "remove-link " + change.from + " " + change.to;
+    case ChangeType::LinkUp:       return "link-up " + change.from + " " + change.to;
+    case ChangeType::LinkDown:     return "link-down " + change.from + " " + change.to;
+    case ChangeType::RouterUp:     return "router-up " + change.from;
+    case ChangeType::RouterDown:   return "router-down " + change.from;
+    }
+    return "";
+}
+
+// Parses one line of the change-set file format. Returns false on malformed input.
+bool parseChange(const string& line, TopologyChange& change) {
+    istringstream in(line);
+    string keyword;
+    in >> keyword;
+    change = TopologyChange{};
+    bool isLink = true;
+    if (keyword == "add-router") { change.type = ChangeType::AddRouter; isLink = false; }
+    else if (keyword == "remove-router") { change.type = ChangeType::RemoveRouter; isLink = false; }
+    else if (keyword == "router-up") { change.type = ChangeType::RouterUp; isLink = false; }
+    else if (keyword == "router-down") { change.type = ChangeType::RouterDown; isLink = false; }
+    else if (keyword == "add-link") change.type = ChangeType::AddLink;
+    else if (keyword == "remove-link") change.type = ChangeType::RemoveLink;
+    else if (keyword == "link-up") change.type = ChangeType::LinkUp;
+    else if (keyword == "link-down") change.type = ChangeType::LinkDown;
+    else return false;
+
+    if (!(in >> change.from)) return false;
+    if (isLink && !(in >> change.to)) return false;
+    if (change.type == ChangeType::AddLink) {
+        if (!(in >> change.cost)) return false;
+        // Optional bandwidth and loss columns, given together
+        vector<int> extra;
+        int value;
+        while (in >> value) extra.push_back(value);
+        if (!in.eof() || (extra.size() != 0 && extra.size() != 2)) return false;
+        if (extra.size() == 2) {
+            change.bandwidth = extra[0];
+            change.lossBp = extra[1];
+        }
+    }
+    string trailing;
+    return !(in >> trailing);
+}
+
+// Reads a change-set file: one operation per line, blank lines and '#' comments ignored
+bool loadChangeSet(const string& filename, ChangeSet& changes) {
+    ifstream fin(filename);
+    if (!fin) {
+        cout << "Failed to open change set " << filename << ".\n";
+        return false;
+    }
+    changes.clear();
+    string line;
+    int lineNo = 0;
+    while (getline(fin, line)) {
+        ++lineNo;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == string::npos || line[start] == '#') continue;
+        TopologyChange change;
+        if (!parseChange(line, change)) {
+            cout << "Error: " << filename << ":" << lineNo << ": malformed change '" << line << "'.\n";
+            return false;
+        }
+        changes.push_back(change);
+    }
+    return true;
+}
+
+// Journal lines bracketing the operations of one change set; a group without its
+// commit line (torn by a crash) is discarded on replay
+const string JOURNAL_BEGIN = "# begin";
+const string JOURNAL_COMMIT = "# commit";
+
+bool fileExists(const string& path) {
+    return ifstream(path).good();
+}
+
+// Renames 'from' over 'to'. rename() does not replace an existing file on Windows,
+// so the target is removed first there; journal recovery covers the gap.
+bool replaceFile(const string& from, const string& to) {
+#ifdef _WIN32
+    remove(to.c_str());
+#endif
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+
+// Forces a file's contents to disk, so that renaming it into place cannot outlive its data
+bool syncFile(const string& path) {
+    FILE* f = fopen(path.c_str(), "ab");
+    if (!f) return false;
+#ifdef _WIN32
+    bool synced = _commit(_fileno(f)) == 0;
+#else
+    bool synced = fsync(fileno(f)) == 0;
+#endif
+    return fclose(f) == 0 && synced;
+}
+
+// Makes renames in the directory holding 'path' durable. NTFS journals renames itself.
+bool syncParentDirectory(const string& path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    size_t slash = path.find_last_of('/');
+    string dir = slash == string::npos ? "." : path.substr(0, max<size_t>(slash, 1));
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool synced = fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+#endif
+}
+
+// Reads journal entries (the change-set format plus transaction markers). Stops at the
+// first malformed or unterminated line, which only a crash mid-write can leave, and
+// reports the number of lines dropped from there on in 'discarded'.
+void readJournal(istream& in, ChangeSet& changes, size_t& discarded) {
+    changes.clear();
+    discarded = 0;
+    ChangeSet group;
+    bool inGroup = false;
+    string line;
+    while (getline(in, line)) {
+        bool complete = !in.eof(); // The last line of a torn write has no newline
+        TopologyChange change;
+        if (complete && line == JOURNAL_BEGIN && !inGroup) {
+            inGroup = true;
+            group.clear();
+        }
+        else if (complete && line == JOURNAL_COMMIT && inGroup) {
+            inGroup = false;
+            changes.insert(changes.end(), group.begin(), group.end());
+        }
+        else if (complete && line.empty()) {
+            continue;
+        }
+        else if (complete && parseChange(line, change)) {
+            (inGroup ? group : changes).push_back(change);
+        }
+        else {
+            discarded = 1;
+            while (getline(in, line)) ++discarded;
+            break;
+        }
+    }
+    if (inGroup) discarded += group.size() + 1;
+}
+
+// Append-only log of topology mutations next to a full snapshot, so that saving a
+// small edit costs one line. Files for base path B:
+//   B.snap                 topology in the saveToFile format
+//   B.journal              changes made since the snapshot, one per line
+//   B.snap.tmp             snapshot being written by a compaction
+//   B.journal.compacting   journal being folded into the new snapshot
+// Every line is flushed as it is recorded.
+class ChangeJournal {
+public:
+    explicit ChangeJournal(const string& basePath) : base(basePath) {}
+
+    const string& basePath() const { return base; }
+    string snapshotPath() const { return base + ".snap"; }
+    string journalPath() const { return base + ".journal"; }
+    string tempSnapshotPath() const { return base + ".snap.tmp"; }
+    string compactingPath() const { return base + ".journal.compacting"; }
+
+    // Opens the journal for appending; 'entriesSoFar' are the entries already in it
+    bool open(size_t entriesSoFar) {
+        out.open(journalPath(), ios::app);
+        entries = entriesSoFar;
+        return out.good();
+    }
+    void close() {
+        out.close();
+    }
+
+    // Changes recorded inside a transaction are written together when it commits
+    void beginTransaction() {
+        if (depth++ == 0) pending.clear();
+    }
+    void commitTransaction() {
+        if (--depth > 0 || pending.empty()) return;
+        out << JOURNAL_BEGIN << "\n" << pending << JOURNAL_COMMIT << "\n";
+        out.flush();
+        pending.clear();
+    }
+
+    void record(const TopologyChange& change) {
+        ++entries;
+        if (depth > 0) {
+            pending += formatChange(change) + "\n";
+            return;
+        }
+        out << formatChange(change) << "\n";
+        out.flush();
+    }
+
+    bool needsCompaction() const {
+        return depth == 0 && entries >= JOURNAL_COMPACT_ENTRIES;
+    }
+
+    size_t entries = 0; // Entries since the last snapshot
+
+private:
+    string base;
+    ofstream out;
+    string pending; // Lines of the open transaction
+    int depth = 0;
 };
 
 // Graph class representing the network topology
 class Graph {
 public:
-    Router nodes[MAX_V];
+    vector<Router> nodes; // Router i is nodes[i]; always V entries
     int V = 0;
     bool silentMode = false;
+    unordered_map<string, int> nameIndex; // Router name -> index in 'nodes'
+    int batchDepth = 0;         // > 0 while a change set or file load is being applied
+    bool pendingLayout = false; // Layout must be recomputed when the batch ends
+    unsigned long long topologyVersion = 0; // Bumped by every mutation; keys the route cache
+    RouteCache routeCache;
+    RoutingMetric routingMetric = RoutingMetric::Latency;
+    MetricWeights metricWeights;
+    int linkIdLimit = 0;      // One past the highest link id handed out
+    vector<int> freeLinkIds;  // Ids of removed links, reused first
+    SearchWorkspace workspace; // Buffers for searches run on the calling thread
+    SsspEngine ssspEngine = SsspEngine::Auto;
+    int ssspThreads = 0;       // Worker threads for parallel engines; 0 = one per hardware thread
+    shared_ptr<const CsrGraph> csr; // Snapshot for parallel engines, rebuilt when stale
+    RouterOrder routerOrder = RouterOrder::Insertion; // Vertex numbering of the snapshot
+    shared_ptr<const DenseApsp> apsp; // All-pairs matrix for routing tables, rebuilt when stale
+    unsigned long long apspVersion = 0;
+    MinPlusKernel minPlusKernel = detectMinPlusKernel();
+    unique_ptr<ChangeJournal> journal; // Records every mutation while open
+    unsigned long long csrVersion = 0;
+    // Connected components of UP routers over UP links. Link/router up-events are merged
+    // in incrementally; anything that can split a component marks them for rebuilding.
+    DisjointSets components;
+    bool componentsValid = false;
 
     Graph() {}
     ~Graph() {}
     void setSilentMode(bool silent) {
         silentMode = silent;
     }
+
+    // Called by every mutator. Outside a batch the derived state (layout) is refreshed
+    // immediately; inside one the refresh is deferred and done once by endBatch().
+    void topologyChanged(bool layoutChanged = false) {
+        ++topologyVersion; // Cached shortest-path trees are now stale
+        pendingLayout = pendingLayout || layoutChanged;
+        if (batchDepth > 0) return;
+        if (pendingLayout) arrangePositions();
+        pendingLayout = false;
+    }
+    void beginBatch() {
+        ++batchDepth;
+    }
+    // Selects the metric routes are computed for; cached routes become stale
+    void setRoutingMetric(RoutingMetric metric, MetricWeights weights = MetricWeights()) {
+        routingMetric = metric;
+        metricWeights = weights;
+        topologyChanged();
+    }
+    void endBatch() {
+        if (--batchDepth == 0) topologyChanged();
+    }
     void arrangePositions() {
         if (V == 0) return;
         for (int i = 0; i < V; ++i) {
@@ -100,12 +1477,8 @@ public:
         }
     }
     int getRouterIndex(const string& name) {
-        for (int i = 0; i < V; ++i) {
-            if (nodes[i].name == name) {
-                return i;
-            }
-        }
-        return -1;
+        auto it = nameIndex.find(name);
+        return it == nameIndex.end() ? -1 : it->second;
     }
     void addRouter(const string& name = "") {
         if (V >= MAX_V) {
@@ -117,243 +1490,1440 @@ public:
             if (!silentMode) cout << "Router " << routerName << " already exists.\n";
             return;
         }
+        nodes.emplace_back();
         nodes[V].name = routerName;
-        nodes[V].up = true;
-        nodes[V].head = nullptr;
+        nameIndex[routerName] = V;
+        if (componentsValid) components.add();
 
         V++; // Increment the count of active routers
-        arrangePositions(); // Recalculate positions for all routers
+        topologyChanged(true); // Recalculate positions for all routers
+        journalChange(ChangeType::AddRouter, routerName);
         if (!silentMode) cout << "Router " << routerName << " added.\n";
     }
 
-    // Removes a router from the graph
+    // Removes a router from the graph.
+    // Only the removed router's own links are visited (via their twins), and the
+    // last router is moved into the freed slot so every other index stays valid.
     void removeRouter(const string& name) {
         int idx = getRouterIndex(name);
         if (idx == -1) {
             cerr << "Error: Router '" << name << "' does not exist.\n";
             return;
         }
-        // 1. Remove all incoming edges to 'idx' from other routers
-        for (int i = 0; i < V; ++i) {
-            if (i == idx) continue; // Skip the router being removed
-            removeEdge(nodes[i].name, name, false);
+        // 1. Unlink the reverse direction of every link from the neighbor's list
+        for (EdgeNode* edge = nodes[idx].head; edge; edge = edge->next) {
+            freeLinkIds.push_back(edge->linkId);
+            unlinkEdge(edge->dest, edge->twin);
         }
-        // 2. Shift remaining routers to fill the gap
-        for (int i = idx; i < V - 1; ++i) {
-            nodes[i] = move(nodes[i + 1]);
+        clearEdges(idx);
+
+        // 2. Move the last router into the gap and retarget its neighbors' links
+        int last = V - 1;
+        if (idx != last) {
+            nodes[idx] = move(nodes[last]);
+            for (EdgeNode* edge = nodes[idx].head; edge; edge = edge->next) {
+                edge->twin->dest = idx;
+            }
+            nameIndex[nodes[idx].name] = idx;
         }
+        nodes.pop_back();
+        nameIndex.erase(name);
+        componentsValid = false;
+
         // Decrement the count of active routers
         V--;
-        arrangePositions(); // Recalculate positions
-        cout << "Router " << name << " removed.\n";
+        topologyChanged(true); // Recalculate positions
+        journalChange(ChangeType::RemoveRouter, name);
+        if (!silentMode) cout << "Router " << name << " removed.\n";
+    }
+
+    // Adds a new link or updates the metrics of an existing link between two routers.
+    // Updating a link brings it UP. A bandwidth or loss of -1 keeps the current value
+    // (0 for a new link).
+    void addEdge(const string& fromName, const string& toName, int cost, int bandwidth = -1, int lossBp = -1) {
+        int u = getRouterIndex(fromName);
+        int v = getRouterIndex(toName);
+
+        if (u == -1 || v == -1) {
+            if (!silentMode) cout << "Invalid router names.\n";
+            return;
+        }
+        if (u == v) {
+            if (!silentMode) cout << "Cannot add link from a router to itself.\n";
+            return;
+        }
+        if (cost < 0) {
+            if (!silentMode) cout << "Link cost must not be negative.\n";
+            return;
+        }
+
+        // Check if an edge already exists and update its cost
+        if (updateEdgeMetrics(u, v, cost, bandwidth, lossBp)) {
+            linkCameUp(u, v);
+            topologyChanged();
+            journalChange(ChangeType::AddLink, fromName, toName, cost, bandwidth, lossBp);
+            if (!silentMode) cout << "Updated link cost between " << fromName << " and " << toName << " to " << cost << " ms.\n";
+            return;
+        }
+
+        // If no edge exists, create new EdgeNode objects for both directions
+        EdgeNode* node = new EdgeNode{ v, cost, nullptr, true, max(bandwidth, 0), max(lossBp, 0) };
+        EdgeNode* node2 = new EdgeNode{ u, cost, nullptr, true, max(bandwidth, 0), max(lossBp, 0) };
+        node->twin = node2;
+        node2->twin = node;
+        node->linkId = node2->linkId = acquireLinkId();
+        pushEdge(u, node);
+        pushEdge(v, node2);
+        linkCameUp(u, v);
+        topologyChanged();
+        journalChange(ChangeType::AddLink, fromName, toName, cost, bandwidth, lossBp);
+
+        if (!silentMode) cout << "Link added between " << fromName << " and " << toName << " with cost " << cost << " ms.\n";
+    }
+
+    // Helper to update the metrics of an existing edge and bring it UP
+    bool updateEdgeMetrics(int u, int v, int newCost, int bandwidth = -1, int lossBp = -1) {
+        EdgeNode* edge = findEdge(u, v);
+        if (!edge) return false;
+        // Update u -> v and its symmetric v -> u node
+        for (EdgeNode* e : { edge, edge->twin }) {
+            e->cost = newCost;
+            if (bandwidth >= 0) e->bandwidth = bandwidth;
+            if (lossBp >= 0) e->lossBp = lossBp;
+            e->up = true;
+        }
+        return true;
+    }
+
+    // Returns the u -> v edge node, or nullptr if the routers are not linked
+    EdgeNode* findEdge(int u, int v) {
+        for (EdgeNode* edge = nodes[u].head; edge; edge = edge->next) {
+            if (edge->dest == v) return edge;
+        }
+        return nullptr;
+    }
+
+    // Merges the components joined by an UP link between routers u and v
+    void linkCameUp(int u, int v) {
+        if (componentsValid && nodes[u].up && nodes[v].up) components.unite(u, v);
+    }
+
+    // Recomputes the components from scratch in O(V + E)
+    void rebuildComponents() {
+        components.reset(V);
+        for (int u = 0; u < V; ++u) {
+            if (!nodes[u].up) continue;
+            for (EdgeNode* edge = nodes[u].head; edge; edge = edge->next) {
+                if (u < edge->dest && edge->up && nodes[edge->dest].up) components.unite(u, edge->dest);
+            }
+        }
+        componentsValid = true;
+    }
+
+    // True if a path between two distinct routers can exist: both are UP and in the
+    // same component. Answers in near-constant time once the components are built.
+    bool reachable(int src, int dest) {
+        if (!componentsValid) rebuildComponents();
+        return nodes[src].up && nodes[dest].up && components.find(src) == components.find(dest);
+    }
+
+    // Read-only variant of reachable() for const callers; optimistic if the components are stale
+    bool mayReach(int src, int dest) const {
+        if (!componentsValid) return true;
+        return nodes[src].up && nodes[dest].up && components.findRoot(src) == components.findRoot(dest);
+    }
+
+    // Finds bridges and articulation points of the UP topology with an iterative
+    // Tarjan DFS (low-link values), in O(V + E)
+    CriticalElements findCriticalElements() const {
+        CriticalElements result;
+        vector<int> disc(V, -1), low(V, 0), parentLink(V, -1);
+        vector<bool> isArticulation(V, false);
+        vector<pair<int, EdgeNode*>> stack; // (router, next link to explore)
+        UpFilter allowed{ nodes.data() };
+        int timer = 0;
+
+        for (int root = 0; root < V; ++root) {
+            if (!nodes[root].up || disc[root] != -1) continue;
+            disc[root] = low[root] = timer++;
+            stack.push_back({ root, nodes[root].head });
+            int rootChildren = 0;
+
+            while (!stack.empty()) {
+                int u = stack.back().first;
+                EdgeNode* edge = stack.back().second;
+                if (edge) {
+                    stack.back().second = edge->next;
+                    if (!allowed(edge)) continue;
+                    int v = edge->dest;
+                    if (disc[v] == -1) {
+                        parentLink[v] = edge->linkId;
+                        disc[v] = low[v] = timer++;
+                        if (u == root) ++rootChildren;
+                        stack.push_back({ v, nodes[v].head });
+                    }
+                    else if (edge->linkId != parentLink[u]) {
+                        low[u] = min(low[u], disc[v]); // Back link
+                    }
+                    continue;
+                }
+                // All links of u explored: report to its DFS parent
+                stack.pop_back();
+                if (stack.empty()) break;
+                int p = stack.back().first;
+                low[p] = min(low[p], low[u]);
+                if (low[u] > disc[p]) result.bridges.push_back(parentLink[u]);
+                if (p != root && low[u] >= disc[p]) isArticulation[p] = true;
+            }
+            if (rootChildren > 1) isArticulation[root] = true;
+        }
+        for (int i = 0; i < V; ++i) {
+            if (isArticulation[i]) result.articulationPoints.push_back(i);
+        }
+        return result;
+    }
+
+    // Computes router and link betweenness with Brandes' algorithm for the selected
+    // routing metric. samples = 0 searches from every UP router; otherwise that many
+    // sources are drawn at random and the totals scaled up, with error bounds from
+    // Hoeffding's inequality. Sources are spread over threads, each with its own
+    // workspace and accumulators, which are summed at the end.
+    BetweennessResult computeBetweenness(int samples = 0, int threads = 0, unsigned seed = 1) const {
+        switch (routingMetric) {
+        case RoutingMetric::WeightedSum:   return betweennessWith(WeightedSumCost{ metricWeights }, samples, threads, seed);
+        case RoutingMetric::Lexicographic: return betweennessWith(LexicographicCost{}, samples, threads, seed);
+        default:                           return betweennessWith(LatencyCost{}, samples, threads, seed);
+        }
+    }
+
+    template <class Cost>
+    BetweennessResult betweennessWith(const Cost& policy, int samples, int threads, unsigned seed) const {
+        BetweennessResult result;
+        vector<int> sources;
+        for (int i = 0; i < V; ++i) {
+            if (nodes[i].up) sources.push_back(i);
+        }
+        int n = (int)sources.size();
+        result.upRouters = n;
+        result.router.assign(V, 0.0);
+        result.link.assign(linkIdLimit, 0.0);
+        if (samples > 0 && samples < n) {
+            shuffle(sources.begin(), sources.end(), mt19937(seed));
+            sources.resize(samples);
+            result.sampled = true;
+        }
+        result.sources = (int)sources.size();
+        if (sources.empty()) return result;
+
+        threads = min(resolveThreadCount(threads), (int)sources.size());
+        vector<vector<double>> routerAcc(threads), linkAcc(threads);
+        atomic<size_t> next(0);
+        auto worker = [&](int t) {
+            SearchWorkspace ws;
+            vector<double> sigma, delta;
+            vector<int> position;
+            routerAcc[t].assign(V, 0.0);
+            linkAcc[t].assign(linkIdLimit, 0.0);
+            for (size_t i = next++; i < sources.size(); i = next++) {
+                accumulateDependencies(sources[i], policy, ws.state<typename Cost::Dist>(),
+                                       sigma, delta, position, routerAcc[t], linkAcc[t]);
+            }
+        };
+        vector<thread> workers;
+        for (int t = 1; t < threads; ++t) workers.emplace_back(worker, t);
+        worker(0);
+        for (thread& w : workers) w.join();
+
+        // Each unordered pair was counted from both ends; samples are scaled to all sources
+        double scale = 0.5 * n / result.sources;
+        for (int t = 0; t < threads; ++t) {
+            for (int i = 0; i < V; ++i) result.router[i] += routerAcc[t][i] * scale;
+            for (int id = 0; id < linkIdLimit; ++id) result.link[id] += linkAcc[t][id] * scale;
+        }
+        if (result.sampled && n > 1) {
+            // Per-source dependencies, divided by their maximum, lie in [0, 1]; Hoeffding plus
+            // a union bound over all routers (links) bounds the error of the sample mean
+            double k = result.sources;
+            double factor = (double)n / (n - 1);
+            result.routerErrorBound = sqrt(log(2.0 * n / BETWEENNESS_CONFIDENCE_DELTA) / (2 * k)) * factor;
+            result.linkErrorBound = sqrt(log(2.0 * max(linkCount(), 1) / BETWEENNESS_CONFIDENCE_DELTA) / (2 * k)) * factor;
+        }
+        return result;
+    }
+
+    // One Brandes step: a search from 'src' on the shared kernel, path counts (sigma)
+    // over tight links in settle order, then dependencies accumulated in reverse order
+    template <class Cost>
+    void accumulateDependencies(int src, const Cost& policy, SearchState<typename Cost::Dist>& state,
+                                vector<double>& sigma, vector<double>& delta, vector<int>& position,
+                                vector<double>& routerAcc, vector<double>& linkAcc) const {
+        UpFilter allowed{ nodes.data() };
+        searchShortest(src, -1, policy, allowed, state);
+        const vector<int>& order = state.order;
+        sigma.assign(V, 0.0);
+        delta.assign(V, 0.0);
+        position.assign(V, -1);
+        for (size_t i = 0; i < order.size(); ++i) position[order[i]] = (int)i;
+
+        // A link v -> w lies on a shortest path iff v was settled first and the link is tight.
+        // Settle order also keeps zero-cost links from forming predecessor cycles.
+        auto isPredecessor = [&](int w, const EdgeNode* edge) {
+            int v = edge->dest;
+            return position[v] != -1 && position[v] < position[w] && allowed(edge)
+                && policy.extend(state.dist[v], edge) == state.dist[w];
+        };
+        sigma[src] = 1;
+        for (size_t i = 1; i < order.size(); ++i) {
+            int w = order[i];
+            for (EdgeNode* edge = nodes[w].head; edge; edge = edge->next) {
+                if (isPredecessor(w, edge)) sigma[w] += sigma[edge->dest];
+            }
+        }
+        for (size_t i = order.size(); i-- > 1;) {
+            int w = order[i];
+            double share = (1.0 + delta[w]) / sigma[w];
+            for (EdgeNode* edge = nodes[w].head; edge; edge = edge->next) {
+                if (!isPredecessor(w, edge)) continue;
+                double c = sigma[edge->dest] * share;
+                delta[edge->dest] += c;
+                linkAcc[edge->linkId] += c;
+            }
+            routerAcc[w] += delta[w];
+        }
+    }
+
+    // Prints the routers and links that carry the most shortest paths
+    void printCriticalityRanking(const BetweennessResult& result) {
+        int n = result.upRouters;
+        double routerPairs = n > 2 ? (double)(n - 1) * (n - 2) / 2 : 1; // Pairs a router can be between
+        double allPairs = n > 1 ? (double)n * (n - 1) / 2 : 1;
+        cout << "Betweenness centrality (" << (result.sampled ? "sampled from " : "exact, ") << result.sources << " sources";
+        if (result.sampled) {
+            cout << "; normalized error <= " << result.routerErrorBound << " for routers, "
+                 << result.linkErrorBound << " for links, with " << (1 - BETWEENNESS_CONFIDENCE_DELTA) * 100 << "% confidence";
+        }
+        cout << "):\n";
+
+        vector<int> routers(V);
+        iota(routers.begin(), routers.end(), 0);
+        int shownRouters = min(V, BETWEENNESS_TOP);
+        partial_sort(routers.begin(), routers.begin() + shownRouters, routers.end(),
+                     [&](int a, int b) { return result.router[a] > result.router[b]; });
+        cout << "Router\t\tPaths\t\tNormalized\n";
+        for (int i = 0; i < shownRouters; ++i) {
+            int r = routers[i];
+            cout << nodes[r].name << "\t\t" << result.router[r] << "\t\t" << result.router[r] / routerPairs << "\n";
+        }
+
+        vector<pair<int, int>> linkEnds(linkIdLimit, { -1, -1 });
+        for (int u = 0; u < V; ++u) {
+            for (EdgeNode* edge = nodes[u].head; edge; edge = edge->next) {
+                if (u < edge->dest) linkEnds[edge->linkId] = { u, edge->dest };
+            }
+        }
+        vector<int> links;
+        for (int id = 0; id < linkIdLimit; ++id) {
+            if (linkEnds[id].first != -1) links.push_back(id);
+        }
+        int shownLinks = min((int)links.size(), BETWEENNESS_TOP);
+        partial_sort(links.begin(), links.begin() + shownLinks, links.end(),
+                     [&](int a, int b) { return result.link[a] > result.link[b]; });
+        cout << "Link\t\t\tPaths\t\tNormalized\n";
+        for (int i = 0; i < shownLinks; ++i) {
+            int id = links[i];
+            cout << nodes[linkEnds[id].first].name << " <--> " << nodes[linkEnds[id].second].name << "\t\t"
+                 << result.link[id] << "\t\t" << result.link[id] / allPairs << "\n";
+        }
+    }
+
+    // Prints components, bridges and articulation points of the UP topology
+    void printConnectivityReport() {
+        if (!componentsValid) rebuildComponents();
+        unordered_map<int, int> componentSize; // Root -> UP routers in the component
+        int downRouters = 0;
+        for (int i = 0; i < V; ++i) {
+            if (nodes[i].up) ++componentSize[components.find(i)];
+            else ++downRouters;
+        }
+        int largest = 0;
+        for (auto& entry : componentSize) largest = max(largest, entry.second);
+        cout << "Connectivity Report:\n";
+        cout << "Components: " << componentSize.size() << " (largest has " << largest << " routers";
+        if (downRouters > 0) cout << ", " << downRouters << " routers DOWN";
+        cout << ")\n";
+        if (componentSize.size() > 1) cout << "The network is partitioned.\n";
+
+        // Link id -> endpoint names, only needed for the links being reported
+        CriticalElements critical = findCriticalElements();
+        unordered_map<int, pair<int, int>> linkEnds;
+        for (int id : critical.bridges) linkEnds[id] = { -1, -1 };
+        for (int u = 0; u < V && !linkEnds.empty(); ++u) {
+            for (EdgeNode* edge = nodes[u].head; edge; edge = edge->next) {
+                auto it = linkEnds.find(edge->linkId);
+                if (it != linkEnds.end() && u < edge->dest) it->second = { u, edge->dest };
+            }
+        }
+        cout << "Bridges (critical links): " << critical.bridges.size() << "\n";
+        for (size_t i = 0; i < critical.bridges.size() && i < REPORT_LIST_LIMIT; ++i) {
+            pair<int, int> ends = linkEnds[critical.bridges[i]];
+            cout << "  " << nodes[ends.first].name << " <--> " << nodes[ends.second].name << "\n";
+        }
+        if (critical.bridges.size() > REPORT_LIST_LIMIT) cout << "  ... " << critical.bridges.size() - REPORT_LIST_LIMIT << " more\n";
+        cout << "Articulation points (critical routers): " << critical.articulationPoints.size() << "\n";
+        for (size_t i = 0; i < critical.articulationPoints.size() && i < REPORT_LIST_LIMIT; ++i) {
+            cout << "  " << nodes[critical.articulationPoints[i]].name << "\n";
+        }
+        if (critical.articulationPoints.size() > REPORT_LIST_LIMIT) {
+            cout << "  ... " << critical.articulationPoints.size() - REPORT_LIST_LIMIT << " more\n";
+        }
+    }
+
+    // Number of links currently in the topology
+    int linkCount() const {
+        return linkIdLimit - (int)freeLinkIds.size();
+    }
+
+    // Returns an unused link id, reusing those of removed links first
+    int acquireLinkId() {
+        if (freeLinkIds.empty()) return linkIdLimit++;
+        int id = freeLinkIds.back();
+        freeLinkIds.pop_back();
+        return id;
+    }
+
+    // Inserts an edge node at the front of a router's adjacency list
+    void pushEdge(int routerIdx, EdgeNode* edge) {
+        edge->prev = nullptr;
+        edge->next = nodes[routerIdx].head;
+        if (edge->next) edge->next->prev = edge;
+        nodes[routerIdx].head = edge;
+    }
+
+    // Detaches an edge node from a router's adjacency list and deallocates it
+    void unlinkEdge(int routerIdx, EdgeNode* edge) {
+        if (edge->prev) edge->prev->next = edge->next;
+        else nodes[routerIdx].head = edge->next;
+        if (edge->next) edge->next->prev = edge->prev;
+        delete edge;
+    }
+
+    // Removes a link between two routers
+    void removeEdge(const string& fromName, const string& toName, bool printMessage = true) {
+        int u = getRouterIndex(fromName);
+        int v = getRouterIndex(toName);
+
+        if (u == -1 || v == -1) {
+            if (printMessage) cout << "Invalid router names.\n";
+            return;
+        }
+
+        EdgeNode* edge = findEdge(u, v);
+        if (edge) {
+            freeLinkIds.push_back(edge->linkId);
+            unlinkEdge(v, edge->twin); // Remove v -> u (symmetric)
+            unlinkEdge(u, edge);       // Remove u -> v
+            componentsValid = false;
+            topologyChanged();
+            journalChange(ChangeType::RemoveLink, fromName, toName);
+        }
+
+        if (printMessage) cout << "Link removed between " << fromName << " and " << toName << ".\n";
+    }
+
+    // Toggles the UP/DOWN status of a router
+    void toggleRouterStatus(const string& name) {
+        int idx = getRouterIndex(name);
+        if (idx == -1) {
+            cout << "Router " << name << " not found.\n";
+            return;
+        }
+        setRouterStatus(name, !nodes[idx].up);
+    }
+
+    // Sets the UP/DOWN status of a router
+    void setRouterStatus(const string& name, bool up) {
+        int idx = getRouterIndex(name);
+        if (idx == -1) {
+            cout << "Router " << name << " not found.\n";
+            return;
+        }
+        nodes[idx].up = up;
+        if (!up) componentsValid = false;
+        else if (componentsValid) {
+            for (EdgeNode* edge = nodes[idx].head; edge; edge = edge->next) {
+                if (edge->up) linkCameUp(idx, edge->dest);
+            }
+        }
+        topologyChanged();
+        journalChange(up ? ChangeType::RouterUp : ChangeType::RouterDown, name);
+        if (!silentMode) cout << "Router " << name << " is now " << (nodes[idx].up ? "UP" : "DOWN") << ".\n";
+    }
+
+    // Toggles the UP/DOWN status of a link
+    void toggleLink(const string& fromName, const string& toName, bool up) {
+        int u = getRouterIndex(fromName);
+        int v = getRouterIndex(toName);
+        if (u == -1 || v == -1) {
+            cout << "Invalid router names.\n";
+            return;
+        }
+
+        EdgeNode* edge = findEdge(u, v);
+        if (edge) {
+            // Update u -> v and v -> u
+            edge->up = up;
+            edge->twin->up = up;
+            if (up) linkCameUp(u, v);
+            else componentsValid = false;
+            topologyChanged();
+            journalChange(up ? ChangeType::LinkUp : ChangeType::LinkDown, fromName, toName);
+        }
+        if (!edge) cout << "Link not found.\n";
+        else if (!silentMode) cout << "Link " << fromName << " <--> " << toName << " is now " << (up ? "UP" : "DOWN") << ".\n";
+    }
+
+    // Checks a change set against the current topology without modifying it.
+    // Every operation is checked against the state left by the ones before it.
+    // On failure, 'error' describes the first invalid operation.
+    bool validateChangeSet(const ChangeSet& changes, string& error) {
+        // Simulated state, layered over the real graph. A router removed during the
+        // batch loses all its real links, even if it is added again later.
+        unordered_map<string, bool> routerPresent;
+        unordered_map<string, size_t> removedAt;        // Router -> op index of its last removal
+        map<pair<string, string>, pair<bool, size_t>> linkPresent; // Link -> (present, op index)
+        int routerCount = V;
+
+        auto routerExists = [&](const string& name) {
+            auto it = routerPresent.find(name);
+            return it != routerPresent.end() ? it->second : getRouterIndex(name) != -1;
+        };
+        auto linkKey = [](const string& a, const string& b) {
+            return a < b ? make_pair(a, b) : make_pair(b, a);
+        };
+        auto linkExists = [&](const string& a, const string& b) {
+            if (!routerExists(a) || !routerExists(b)) return false;
+            auto ra = removedAt.find(a), rb = removedAt.find(b);
+            size_t lastRemoval = 0;
+            bool endpointRemoved = false;
+            if (ra != removedAt.end()) { endpointRemoved = true; lastRemoval = ra->second; }
+            if (rb != removedAt.end()) { endpointRemoved = true; lastRemoval = max(lastRemoval, rb->second); }
+            auto it = linkPresent.find(linkKey(a, b));
+            if (it != linkPresent.end() && (!endpointRemoved || it->second.second > lastRemoval)) {
+                return it->second.first;
+            }
+            if (endpointRemoved) return false;
+            // Routers added earlier in this batch have no links in the graph yet
+            int u = getRouterIndex(a), v = getRouterIndex(b);
+            return u != -1 && v != -1 && findEdge(u, v) != nullptr;
+        };
+
+        for (size_t i = 0; i < changes.size(); ++i) {
+            const TopologyChange& c = changes[i];
+            string reason;
+            switch (c.type) {
+            case ChangeType::AddRouter:
+                if (c.from.empty()) reason = "router name is empty";
+                else if (routerExists(c.from)) reason = "router already exists";
+                else if (routerCount >= MAX_V) reason = "max routers reached";
+                else { routerPresent[c.from] = true; ++routerCount; }
+                break;
+            case ChangeType::RemoveRouter:
+                if (!routerExists(c.from)) reason = "router does not exist";
+                else { routerPresent[c.from] = false; removedAt[c.from] = i; --routerCount; }
+                break;
+            case ChangeType::RouterUp:
+            case ChangeType::RouterDown:
+                if (!routerExists(c.from)) reason = "router does not exist";
+                break;
+            case ChangeType::AddLink:
+                if (!routerExists(c.from) || !routerExists(c.to)) reason = "router does not exist";
+                else if (c.from == c.to) reason = "link from a router to itself";
+                else if (c.cost < 0) reason = "negative link cost";
+                else linkPresent[linkKey(c.from, c.to)] = { true, i };
+                break;
+            case ChangeType::RemoveLink:
+            case ChangeType::LinkUp:
+            case ChangeType::LinkDown:
+                if (!linkExists(c.from, c.to)) reason = "link does not exist";
+                else if (c.type == ChangeType::RemoveLink) linkPresent[linkKey(c.from, c.to)] = { false, i };
+                break;
+            }
+            if (!reason.empty()) {
+                error = "operation " + to_string(i + 1) + " (" + formatChange(c) + "): " + reason;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Validates and applies a change set as one transaction: console output is
+    // suppressed and derived state is refreshed once at the end. If 'undo' is given,
+    // it receives the change set that restores the previous topology when applied.
+    bool applyChangeSet(const ChangeSet& changes, ChangeSet* undo = nullptr) {
+        string error;
+        if (!validateChangeSet(changes, error)) {
+            cerr << "Error: change set rejected at " << error << ".\n";
+            return false;
+        }
+
+        vector<ChangeSet> inverses; // Inverse of each applied operation, in apply order
+        if (undo) inverses.reserve(changes.size());
+        bool originalSilentMode = silentMode;
+        setSilentMode(true);
+        beginBatch();
+        if (journal) journal->beginTransaction();
+        for (const TopologyChange& c : changes) {
+            if (undo) inverses.push_back(inverseOf(c));
+            applyChange(c);
+        }
+        if (journal) {
+            journal->commitTransaction();
+            if (journal->needsCompaction()) compactJournal();
+        }
+        endBatch();
+        setSilentMode(originalSilentMode);
+
+        if (undo) {
+            undo->clear();
+            for (auto it = inverses.rbegin(); it != inverses.rend(); ++it) {
+                undo->insert(undo->end(), it->begin(), it->end());
+            }
+        }
+        if (!silentMode) cout << "Applied change set of " << changes.size() << " operations.\n";
+        return true;
+    }
+
+    // Applies a single, already validated change
+    void applyChange(const TopologyChange& c) {
+        switch (c.type) {
+        case ChangeType::AddRouter:    addRouter(c.from); break;
+        case ChangeType::RemoveRouter: removeRouter(c.from); break;
+        case ChangeType::AddLink:      addEdge(c.from, c.to, c.cost, c.bandwidth, c.lossBp); break;
+        case ChangeType::RemoveLink:   removeEdge(c.from, c.to, false); break;
+        case ChangeType::LinkUp:       toggleLink(c.from, c.to, true); break;
+        case ChangeType::LinkDown:     toggleLink(c.from, c.to, false); break;
+        case ChangeType::RouterUp:     setRouterStatus(c.from, true); break;
+        case ChangeType::RouterDown:   setRouterStatus(c.from, false); break;
+        }
+    }
+
+    // Returns the operations that undo 'c' given the current (pre-change) topology
+    ChangeSet inverseOf(const TopologyChange& c) {
+        // Restores a link as it is now: same metrics and UP/DOWN state
+        auto restoreLink = [](ChangeSet& out, const string& a, const string& b, EdgeNode* edge) {
+            out.push_back({ ChangeType::AddLink, a, b, edge->cost, edge->bandwidth, edge->lossBp });
+            if (!edge->up) out.push_back({ ChangeType::LinkDown, a, b });
+        };
+        ChangeSet out;
+        int u = getRouterIndex(c.from);
+        int v = getRouterIndex(c.to);
+        switch (c.type) {
+        case ChangeType::AddRouter:
+            out.push_back({ ChangeType::RemoveRouter, c.from });
+            break;
+        case ChangeType::RemoveRouter:
+            out.push_back({ ChangeType::AddRouter, c.from });
+            if (!nodes[u].up) out.push_back({ ChangeType::RouterDown, c.from });
+            for (EdgeNode* e = nodes[u].head; e; e = e->next) {
+                restoreLink(out, c.from, nodes[e->dest].name, e);
+            }
+            break;
+        case ChangeType::AddLink:
+        case ChangeType::RemoveLink: {
+            EdgeNode* edge = findEdge(u, v);
+            if (edge) restoreLink(out, c.from, c.to, edge);
+            else out.push_back({ ChangeType::RemoveLink, c.from, c.to });
+            break;
+        }
+        case ChangeType::LinkUp:
+        case ChangeType::LinkDown:
+            out.push_back({ findEdge(u, v)->up ? ChangeType::LinkUp : ChangeType::LinkDown, c.from, c.to });
+            break;
+        case ChangeType::RouterUp:
+        case ChangeType::RouterDown:
+            out.push_back({ nodes[u].up ? ChangeType::RouterUp : ChangeType::RouterDown, c.from });
+            break;
+        }
+        return out;
+    }
+
+    // Appends a mutation to the open journal, compacting it when it has grown long.
+    // Takes the TopologyChange fields so nothing is built while no journal is open.
+    void journalChange(ChangeType type, const string& from, const string& to = "",
+                       int cost = 0, int bandwidth = -1, int lossBp = -1) {
+        if (!journal) return;
+        journal->record(TopologyChange(type, from, to, cost, bandwidth, lossBp));
+        if (journal->needsCompaction()) compactJournal();
+    }
+
+    // Opens (or creates) the journal at 'base': finishes or rolls back an interrupted
+    // compaction, loads the snapshot, replays the journal on top, then records every
+    // later mutation. A torn tail is dropped and the journal compacted right away.
+    bool openJournal(const string& base) {
+        journal.reset();
+        ChangeJournal files(base);
+        bool hasTemp = fileExists(files.tempSnapshotPath());
+        bool hasCompacting = fileExists(files.compactingPath());
+        if (hasTemp && hasCompacting) {
+            // Crashed after rotating the journal: the new snapshot is complete
+            if (!replaceFile(files.tempSnapshotPath(), files.snapshotPath())) {
+                cout << "Failed to finish the interrupted compaction of " << base << ".\n";
+                return false;
+            }
+            syncParentDirectory(files.snapshotPath());
+        }
+        else if (hasTemp) {
+            remove(files.tempSnapshotPath().c_str()); // Crashed while writing the snapshot
+        }
+        if (hasCompacting) remove(files.compactingPath().c_str()); // Already in the snapshot
+
+        ifstream snapshot(files.snapshotPath());
+        if (snapshot) {
+            if (!readTopology(snapshot)) return false;
+        }
+        else {
+            clearTopology();
+        }
+
+        ChangeSet changes;
+        size_t discarded = 0;
+        ifstream in(files.journalPath());
+        if (in) readJournal(in, changes, discarded);
+        in.close();
+        replayChanges(changes, true);
+
+        journal = make_unique<ChangeJournal>(base);
+        if (!journal->open(changes.size())) {
+            cout << "Failed to open journal " << files.journalPath() << ".\n";
+            journal.reset();
+            return false;
+        }
+        if (discarded > 0) {
+            cout << "Dropped " << discarded << " incomplete journal line(s) left by an interrupted write.\n";
+            compactJournal();
+        }
+        cout << "Journal " << base << " opened: " << V << " routers, " << changes.size() << " change(s) replayed.\n";
+        return true;
+    }
+
+    // Folds the journal into a new snapshot. Each step leaves files that openJournal
+    // can recover from: the snapshot is written to a temporary file, the journal is
+    // renamed aside, the temporary file replaces the snapshot, and only then is the
+    // old journal deleted and a new one started. Files are synced before each rename
+    // and directories after it, so a power loss cannot leave a truncated snapshot.
+    // On failure the old snapshot and journal stay in use and false is returned.
+    bool compactJournal() {
+        if (!journal) return false;
+        const string temp = journal->tempSnapshotPath();
+        const string snapshot = journal->snapshotPath();
+        const string current = journal->journalPath();
+        const string compacting = journal->compactingPath();
+        {
+            ofstream out(temp, ios::trunc);
+            writeTopology(out);
+            out.close();
+            if (!out || !syncFile(temp)) {
+                remove(temp.c_str());
+                cout << "Failed to write snapshot " << temp << ".\n";
+                return false;
+            }
+        }
+        journal->close();
+        bool hasJournal = fileExists(current);
+        if (hasJournal && (!syncFile(current) || rename(current.c_str(), compacting.c_str()) != 0)) {
+            // The snapshot must not replace the old one while this journal still applies to it
+            remove(temp.c_str());
+            return reopenAfterFailedCompaction("Failed to rotate journal " + current);
+        }
+        syncParentDirectory(current);
+        if (!replaceFile(temp, snapshot)) {
+            if (!fileExists(snapshot)) {
+                // Only on Windows, where the old snapshot is removed first: the temporary
+                // snapshot and rotated journal are what openJournal recovers from
+                journal.reset();
+                cout << "Failed to replace snapshot " << snapshot << ". Journaling stopped; "
+                     << "open the journal again to finish the compaction.\n";
+                return false;
+            }
+            remove(temp.c_str());
+            if (hasJournal && rename(compacting.c_str(), current.c_str()) != 0) {
+                // The rotated journal is still replayed over the old snapshot by openJournal
+                journal.reset();
+                cout << "Failed to replace snapshot " << snapshot << " and to restore journal " << current
+                     << ". Journaling stopped; open the journal again to recover.\n";
+                return false;
+            }
+            syncParentDirectory(current);
+            return reopenAfterFailedCompaction("Failed to replace snapshot " + snapshot);
+        }
+        syncParentDirectory(snapshot);
+        remove(compacting.c_str());
+        if (!journal->open(0)) {
+            journal.reset();
+            cout << "Failed to reopen journal " << current << ". Journaling stopped.\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Reports a compaction that was undone and goes on appending to the old journal.
+    // Stops journaling if even that fails, rather than dropping later changes silently.
+    bool reopenAfterFailedCompaction(const string& message) {
+        if (journal->open(journal->entries)) {
+            cout << message << "; the journal keeps its entries.\n";
+        }
+        else {
+            cout << message << ", and the journal could not be reopened. Journaling stopped.\n";
+            journal.reset();
+        }
+        return false;
+    }
+
+    // Applies recorded changes without journaling them. As one batch for recovery;
+    // otherwise one by one, each refreshing derived state as a live change would.
+    void replayChanges(const ChangeSet& changes, bool asBatch) {
+        unique_ptr<ChangeJournal> active = move(journal);
+        bool originalSilentMode = silentMode;
+        setSilentMode(true);
+        if (asBatch) beginBatch();
+        for (const TopologyChange& c : changes) applyChange(c);
+        if (asBatch) endBatch();
+        setSilentMode(originalSilentMode);
+        journal = move(active);
+    }
+
+    // Replays a recorded journal (e.g. a day of link flaps) as fast as possible,
+    // recomputing the routing tree of the first UP router after every change, and
+    // reports the time spent applying changes and routing. With a journal open, the
+    // result is compacted into it afterwards.
+    void benchmarkReplay(const string& filename) {
+        ifstream in(filename);
+        if (!in) {
+            cout << "Failed to open journal " << filename << ".\n";
+            return;
+        }
+        ChangeSet changes;
+        size_t discarded = 0;
+        readJournal(in, changes, discarded);
+        using Clock = chrono::steady_clock;
+        Clock::duration applying{}, routing{};
+        size_t trees = 0;
+        for (const TopologyChange& c : changes) {
+            Clock::time_point start = Clock::now();
+            replayChanges({ c }, false);
+            Clock::time_point applied = Clock::now();
+            int probe = 0;
+            while (probe < V && !nodes[probe].up) ++probe;
+            if (probe < V) {
+                shortestPathTree(probe);
+                ++trees;
+            }
+            applying += applied - start;
+            routing += Clock::now() - applied;
+        }
+        auto seconds = [](Clock::duration d) { return chrono::duration<double>(d).count(); };
+        double total = seconds(applying + routing);
+        cout << "Replayed " << changes.size() << " changes in " << total << " s ("
+             << (total > 0 ? changes.size() / total : 0) << " changes/s): applying " << seconds(applying)
+             << " s, " << trees << " routing trees " << seconds(routing) << " s.\n";
+        if (discarded > 0) cout << "Ignored " << discarded << " incomplete line(s) at the end.\n";
+        if (journal) compactJournal();
+    }
+
+private:
+    // Private helper function for Dijkstra's algorithm.
+    // Computes shortest distances and predecessors from a source router,
+    // using the cost policy of the selected routing metric.
+    DijkstraResult runDijkstra(int src) {
+        switch (routingMetric) {
+        case RoutingMetric::WeightedSum:   return runDijkstra(src, WeightedSumCost{ metricWeights });
+        case RoutingMetric::Lexicographic: return runDijkstra(src, LexicographicCost{});
+        default:                           return runDijkstra(src, LatencyCost{});
+        }
+    }
+
+    // Builds a shortest-path tree with the given cost policy over all UP links
+    template <class Cost>
+    DijkstraResult runDijkstra(int src, const Cost& policy) {
+        using Dist = typename Cost::Dist;
+        // Add bounds checking for src, though it should be handled by callers
+        if (src < 0 || src >= V) {
+            // Return an empty/invalid result if src is out of bounds
+            return {};
+        }
+        SearchState<Dist>& state = workspace.state<Dist>();
+        searchShortest(src, -1, policy, UpFilter{ nodes.data() }, state);
+
+        DijkstraResult result;
+        if constexpr (is_same<Cost, LatencyCost>::value || is_same<Cost, WeightedSumCost>::value) {
+            result.dist = move(state.dist); // Already plain path costs
+        }
+        else {
+            result.dist.resize(V);
+            for (int i = 0; i < V; ++i) {
+                result.dist[i] = state.dist[i] == Cost::infinity() ? INF_COST : Cost::report(state.dist[i]);
+            }
+        }
+        result.prev = move(state.prev);
+        result.firstHop = move(state.firstHop);
+        return result;
+    }
+
+    // Dijkstra search core shared by every query mode, instantiated per cost policy
+    // and link filter. Stops early once 'stopAt' is settled (-1 searches everything).
+    template <class Cost, class Filter>
+    void searchShortest(int src, int stopAt, const Cost& policy, const Filter& allowed,
+                        SearchState<typename Cost::Dist>& state) const {
+        using Dist = typename Cost::Dist;
+        state.reset(V, Cost::infinity());
+        auto& dist = state.dist;
+        auto& heap = state.heap; // Min-priority queue
+        dist[src] = Cost::zero();
+        if (!nodes[src].up) return; // Nothing is reachable through a DOWN router
+        heap.push_back({ dist[src], src });
+
+        while (!heap.empty()) {
+            pop_heap(heap.begin(), heap.end(), greater<>());
+            int u = heap.back().second;
+            heap.pop_back();
+
+            // If already visited, skip
+            if (state.visited[u]) continue;
+            state.visited[u] = true;
+            state.order.push_back(u);
+            if (u == stopAt) break;
+
+            // Explore neighbors. dist[u] is finite here, and link costs are non-negative
+            // ints, so a 64-bit sum cannot overflow.
+            for (EdgeNode* edge = nodes[u].head; edge; edge = edge->next) {
+                int v = edge->dest;
+                if (state.visited[v] || !allowed(edge)) continue;
+
+                Dist new_dist = policy.extend(dist[u], edge);
+                if (new_dist < dist[v]) {
+                    dist[v] = new_dist;
+                    state.prev[v] = u;
+                    state.firstHop[v] = (u == src) ? v : state.firstHop[u]; // u is settled, so its first hop is final
+                    heap.push_back({ new_dist, v });
+                    push_heap(heap.begin(), heap.end(), greater<>());
+                }
+            }
+        }
+    }
+
+    // Hop-limited search core: layer h holds the best cost using at most h links.
+    // Each round only relaxes links out of routers that improved in the previous one.
+    // Only two cost layers are kept; predecessors are stored per improvement, so memory
+    // grows with the relaxations performed rather than with maxHops * V.
+    template <class Cost, class Filter>
+    void searchHopLimited(int src, int maxHops, const Cost& policy, const Filter& allowed,
+                          SearchState<typename Cost::Dist>& state) const {
+        state.layerDist.assign(V, Cost::infinity());
+        state.layerDist[src] = Cost::zero();
+        state.nextLayerDist = state.layerDist;
+        state.steps.clear();
+        state.lastStep.assign(V, -1);
+        state.visited.assign(V, false);
+        state.frontier.clear();
+        if (nodes[src].up) state.frontier.push_back(src);
+
+        state.layers = 0;
+        while (state.layers < maxHops && !state.frontier.empty()) {
+            int layer = state.layers + 1;
+            state.nextFrontier.clear();
+            for (int u : state.frontier) {
+                for (EdgeNode* edge = nodes[u].head; edge; edge = edge->next) {
+                    int v = edge->dest;
+                    if (!allowed(edge)) continue;
+                    auto new_dist = policy.extend(state.layerDist[u], edge);
+                    if (new_dist < state.nextLayerDist[v]) {
+                        state.nextLayerDist[v] = new_dist;
+                        if (!state.visited[v]) {
+                            state.visited[v] = true;
+                            state.nextFrontier.push_back(v);
+                            state.steps.push_back({ layer, u, state.lastStep[v] });
+                            state.lastStep[v] = (int)state.steps.size() - 1;
+                        }
+                        else {
+                            state.steps[state.lastStep[v]].prev = u;
+                        }
+                    }
+                }
+            }
+            // Routers that did not improve keep their cost, so only the improved ones are copied
+            for (int v : state.nextFrontier) {
+                state.layerDist[v] = state.nextLayerDist[v];
+                state.visited[v] = false;
+            }
+            swap(state.frontier, state.nextFrontier);
+            state.layers = layer;
+        }
+    }
+
+    // Runs one query with a fixed cost policy and reconstructs the route to 'dest'
+    template <class Cost>
+    RouteResult routeWith(int src, int dest, const RouteQuery& query, const Cost& policy,
+                          const LinkFilter& allowed, SearchWorkspace& ws) const {
+        SearchState<typename Cost::Dist>& state = ws.state<typename Cost::Dist>();
+        RouteResult result;
+        if (query.maxHops > 0) {
+            searchHopLimited(src, min(query.maxHops, max(V - 1, 1)), policy, allowed, state);
+            auto best = state.layerDist[dest];
+            if (best == Cost::infinity()) return result;
+            // Walk back through the latest improvement of each router that fits in the hops left
+            int h = state.layers;
+            int current = dest;
+            while (current != src) {
+                int step = state.lastStep[current];
+                while (state.steps[step].layer > h) step = state.steps[step].older;
+                result.path.push_back(current);
+                h = state.steps[step].layer - 1;
+                current = state.steps[step].prev;
+            }
+            result.path.push_back(src);
+            result.cost = Cost::report(best);
+        }
+        else {
+            searchShortest(src, dest, policy, allowed, state);
+            if (state.dist[dest] == Cost::infinity()) return result;
+            for (int current = dest; current != -1; current = state.prev[current]) {
+                result.path.push_back(current);
+            }
+            result.cost = Cost::report(state.dist[dest]);
+        }
+        reverse(result.path.begin(), result.path.end());
+        return result;
+    }
+
+public:
+    // Returns the shortest-path tree from 'src', reusing a cached one if the
+    // topology has not changed since it was computed
+    shared_ptr<const DijkstraResult> shortestPathTree(int src) {
+        shared_ptr<const DijkstraResult> tree = routeCache.find(src, topologyVersion);
+        if (!tree) {
+            tree = make_shared<const DijkstraResult>(computeTree(src));
+            routeCache.insert(src, topologyVersion, tree);
+        }
+        return tree;
+    }
+
+    // Computes a shortest-path tree with the selected engine. With a router order
+    // selected, scalar metrics are searched on the renumbered snapshot.
+    DijkstraResult computeTree(int src) {
+        if (src < 0 || src >= V) return {};
+        if (ssspEngine == SsspEngine::DenseApsp && denseApspSuitable()) {
+            shared_ptr<const DenseApsp> m = allPairs();
+            if (m->usable) return m->tree(*csrSnapshot(), src);
+        }
+        if (useDeltaStepping()) {
+            shared_ptr<const CsrGraph> g = csrSnapshot();
+            DijkstraResult result = deltaSteppingSssp(*g, g->internalId(src), autoTuneDelta(*g), ssspThreads);
+            g->mapToExternal(result);
+            return result;
+        }
+        if (routerOrder != RouterOrder::Insertion && routingMetric != RoutingMetric::Lexicographic) {
+            if (!nodes[src].up) return runDijkstra(src); // DOWN routers have no links in the snapshot
+            shared_ptr<const CsrGraph> g = csrSnapshot();
+            DijkstraResult result = csrDijkstra(*g, g->internalId(src));
+            g->mapToExternal(result);
+            return result;
+        }
+        return runDijkstra(src);
+    }
+
+    bool useDeltaStepping() const {
+        if (routingMetric == RoutingMetric::Lexicographic) return false; // Not a scalar sum
+        if (ssspEngine == SsspEngine::DeltaStepping) return true;
+        return ssspEngine == SsspEngine::Auto && linkCount() >= DELTA_STEPPING_MIN_LINKS
+            && resolveThreadCount(ssspThreads) > 1;
+    }
+
+    // Returns a CSR snapshot of the UP links, weighted by the selected routing metric
+    // (latency for the lexicographic metric), numbered by the selected router order.
+    // Rebuilt only after the topology or the order changes.
+    shared_ptr<const CsrGraph> csrSnapshot() {
+        if (csr && csrVersion == topologyVersion) return csr;
+        shared_ptr<const CsrGraph> g;
+        if (routingMetric == RoutingMetric::WeightedSum) g = buildCsr(WeightedSumCost{ metricWeights });
+        else g = buildCsr(LatencyCost{});
+        if (routerOrder != RouterOrder::Insertion) {
+            g = make_shared<const CsrGraph>(renumberCsr(*g, computeRouterOrder(*g, routerOrder)));
+        }
+        csr = g;
+        csrVersion = topologyVersion;
+        return csr;
+    }
+
+    // The all-pairs matrix serves routing tables for scalar metrics when the topology
+    // is dense enough that V searches cost more than one O(V^3) SIMD pass
+    bool denseApspSuitable() const {
+        if (routingMetric == RoutingMetric::Lexicographic || V > DENSE_APSP_MAX_ROUTERS || V == 0) return false;
+        if (ssspEngine == SsspEngine::DenseApsp) return true;
+        return ssspEngine == SsspEngine::Auto && V >= DENSE_APSP_MIN_ROUTERS
+            && linkCount() >= DENSE_APSP_MIN_DENSITY * V * (V - 1) / 2;
     }
 
-    // Adds a new link or updates the cost of an existing link between two routers
-    void addEdge(const string& fromName, const string& toName, int cost) {
-        int u = getRouterIndex(fromName);
-        int v = getRouterIndex(toName);
+    // Returns the all-pairs matrix for the selected metric, computing it if stale
+    shared_ptr<const DenseApsp> allPairs() {
+        if (apsp && apspVersion == topologyVersion) return apsp;
+        if (routingMetric == RoutingMetric::WeightedSum) apsp = buildDenseApsp(WeightedSumCost{ metricWeights });
+        else apsp = buildDenseApsp(LatencyCost{});
+        apspVersion = topologyVersion;
+        return apsp;
+    }
 
-        if (u == -1 || v == -1) {
-            if (!silentMode) cout << "Invalid router names.\n";
-            return;
+    template <class Cost>
+    shared_ptr<const DenseApsp> buildDenseApsp(const Cost& policy) const {
+        auto m = make_shared<DenseApsp>();
+        m->n = V;
+        UpFilter allowed{ nodes.data() };
+        PathCost maxWeight = 0;
+        for (int i = 0; i < V; ++i) {
+            for (EdgeNode* e = nodes[i].head; e; e = e->next) maxWeight = max(maxWeight, policy.weight(e));
         }
-        if (u == v) {
-            if (!silentMode) cout << "Cannot add link from a router to itself.\n";
-            return;
+        if (maxWeight >= DENSE_INF / max(V, 1)) {
+            m->usable = false; // A path of V links could overflow
+            return m;
         }
-
-        // Check if an edge already exists and update its cost
-        if (updateEdgeCost(u, v, cost, true)) { // 'true' to overwrite original cost
-            if (!silentMode) cout << "Updated link cost between " << fromName << " and " << toName << " to " << cost << " ms.\n";
-            return;
+        m->stride = (V + DENSE_APSP_TILE - 1) / DENSE_APSP_TILE * DENSE_APSP_TILE;
+        m->dist.assign((size_t)m->stride * m->stride, DENSE_INF);
+        for (int i = 0; i < m->stride; ++i) m->dist[(size_t)i * m->stride + i] = 0;
+        for (int i = 0; i < V; ++i) {
+            if (!nodes[i].up) continue;
+            for (EdgeNode* e = nodes[i].head; e; e = e->next) {
+                if (!allowed(e)) continue;
+                m->dist[(size_t)i * m->stride + e->dest] = policy.weight(e);
+            }
         }
+        solveDenseApsp(*m, minPlusKernel, ssspThreads);
+        return m;
+    }
 
-        // If no edge exists, create new EdgeNode objects for both directions
-        EdgeNode* node = new EdgeNode{ v, cost, nodes[u].head, cost, true };
-        nodes[u].head = node;
+    // Tree used for a routing table: a row of the all-pairs matrix when the matrix is
+    // current (or forced by the engine), otherwise the cached per-source tree
+    shared_ptr<const DijkstraResult> routingTableTree(int src) {
+        bool matrixReady = apsp && apspVersion == topologyVersion;
+        if (denseApspSuitable() && (matrixReady || ssspEngine == SsspEngine::DenseApsp)) {
+            shared_ptr<const DenseApsp> m = allPairs();
+            if (m->usable) return make_shared<const DijkstraResult>(m->tree(*csrSnapshot(), src));
+        }
+        return shortestPathTree(src);
+    }
 
-        EdgeNode* node2 = new EdgeNode{ u, cost, nodes[v].head, cost, true };
-        nodes[v].head = node2;
+    // Prints every router's routing table, from one all-pairs pass on dense topologies
+    void printAllRoutingTables() {
+        if (denseApspSuitable()) allPairs();
+        for (int i = 0; i < V; ++i) printRoutingTable(i);
+    }
 
-        if (!silentMode) cout << "Link added between " << fromName << " and " << toName << " with cost " << cost << " ms.\n";
+    // Selects the vertex numbering of the snapshot; routing results are unchanged
+    void setRouterOrder(RouterOrder order) {
+        routerOrder = order;
+        csr.reset();
     }
 
-    // Helper to update the cost of an existing edge
-    bool updateEdgeCost(int u, int v, int newCost, bool overwriteOriginal = false) {
-        bool updated = false;
-        // Update u -> v
-        for (auto* edge = nodes[u].head; edge; edge = edge->next) {
-            if (edge->dest == v) {
-                edge->cost = newCost;
-                if (overwriteOriginal) edge->originalCost = newCost;
-                edge->up = (newCost != INT_MAX); // Link is up if cost is not INT_MAX
-                updated = true;
-                break; // Found and updated, can exit loop
+    template <class Cost>
+    shared_ptr<const CsrGraph> buildCsr(const Cost& policy) const {
+        auto g = make_shared<CsrGraph>();
+        UpFilter allowed{ nodes.data() };
+        g->offsets.assign(V + 1, 0);
+        for (int i = 0; i < V; ++i) {
+            int degree = 0;
+            if (nodes[i].up) {
+                for (EdgeNode* e = nodes[i].head; e; e = e->next) degree += allowed(e);
             }
+            g->offsets[i + 1] = g->offsets[i] + degree;
         }
-        // Update v -> u (symmetric)
-        for (auto* edge = nodes[v].head; edge; edge = edge->next) {
-            if (edge->dest == u) {
-                edge->cost = newCost;
-                if (overwriteOriginal) edge->originalCost = newCost;
-                edge->up = (newCost != INT_MAX);
-                updated = true;
-                break; // Found and updated, can exit loop
+        size_t m = g->offsets[V];
+        g->targets.resize(m);
+        g->weights.resize(m);
+        g->linkIds.resize(m);
+        for (int i = 0; i < V; ++i) {
+            if (!nodes[i].up) continue;
+            int pos = g->offsets[i];
+            for (EdgeNode* e = nodes[i].head; e; e = e->next) {
+                if (!allowed(e)) continue;
+                g->targets[pos] = e->dest;
+                g->weights[pos] = policy.weight(e);
+                g->linkIds[pos] = e->linkId;
+                g->maxWeight = max(g->maxWeight, g->weights[pos]);
+                ++pos;
             }
         }
-        return updated;
+        return g;
     }
 
-    // Removes a link between two routers
-    void removeEdge(const string& fromName, const string& toName, bool printMessage = true) {
-        int u = getRouterIndex(fromName);
-        int v = getRouterIndex(toName);
-
-        if (u == -1 || v == -1) {
-            if (printMessage) cout << "Invalid router names.\n";
+    // Replaces the topology with a synthetic one shaped like a large ISP backbone:
+    // routers scattered over a square, each linked to its three nearest neighbors with
+    // a latency proportional to distance, plus 1% long-haul links between random routers.
+    // Routers are named in generation order, which has no relation to their position.
+    void generateTopology(int routers, unsigned seed = 1) {
+        if (journal) {
+            // Recorded as a new snapshot, like a loaded file
+            unique_ptr<ChangeJournal> active = move(journal);
+            generateTopology(routers, seed);
+            journal = move(active);
+            compactJournal();
             return;
         }
-
-        // Lambda function to remove an edge from an adjacency list
-        auto remove = [&](int from, int to) {
-            EdgeNode** curr = &nodes[from].head;
-            while (*curr) {
-                if ((*curr)->dest == to) {
-                    EdgeNode* temp = *curr;
-                    *curr = (*curr)->next; // Link previous node to next node
-                    delete temp;            // Deallocate the removed EdgeNode
-                    return;
+        routers = max(0, min(routers, MAX_V));
+        clearTopology();
+        bool originalSilentMode = silentMode;
+        setSilentMode(true);
+        beginBatch();
+        mt19937 rng(seed);
+        uniform_real_distribution<double> coordinate(0.0, 1.0);
+        vector<double> x(routers), y(routers);
+        int side = max(1, (int)sqrt(routers / 2.0)); // About two routers per grid cell
+        vector<vector<int>> cells((size_t)side * side);
+        nodes.reserve(routers);
+        for (int i = 0; i < routers; ++i) {
+            x[i] = coordinate(rng);
+            y[i] = coordinate(rng);
+            cells[(size_t)min(side - 1, (int)(y[i] * side)) * side + min(side - 1, (int)(x[i] * side))].push_back(i);
+            addRouter("R" + to_string(i));
+        }
+        auto latency = [&](int a, int b) {
+            return 1 + (int)(hypot(x[a] - x[b], y[a] - y[b]) * 1000);
+        };
+        vector<pair<double, int>> nearby;
+        for (int i = 0; i < routers; ++i) {
+            int cx = min(side - 1, (int)(x[i] * side)), cy = min(side - 1, (int)(y[i] * side));
+            nearby.clear();
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int nx = cx + dx, ny = cy + dy;
+                    if (nx < 0 || ny < 0 || nx >= side || ny >= side) continue;
+                    for (int j : cells[(size_t)ny * side + nx]) {
+                        if (j != i) nearby.push_back({ hypot(x[i] - x[j], y[i] - y[j]), j });
+                    }
                 }
-                curr = &(*curr)->next;
             }
-            };
-
-        remove(u, v); // Remove u -> v
-        remove(v, u); // Remove v -> u (symmetric)
-
-        if (printMessage) cout << "Link removed between " << fromName << " and " << toName << ".\n";
-    }
-
-    // Toggles the UP/DOWN status of a router
-    void toggleRouterStatus(const string& name) {
-        int idx = getRouterIndex(name);
-        if (idx == -1) {
-            cout << "Router " << name << " not found.\n";
-            return;
+            size_t k = min<size_t>(3, nearby.size());
+            partial_sort(nearby.begin(), nearby.begin() + k, nearby.end());
+            for (size_t n = 0; n < k; ++n) {
+                addEdge(nodes[i].name, nodes[nearby[n].second].name, latency(i, nearby[n].second));
+            }
         }
-        nodes[idx].up = !nodes[idx].up;
-        cout << "Router " << name << " is now " << (nodes[idx].up ? "UP" : "DOWN") << ".\n";
+        for (int i = 0; routers > 1 && i < routers / 100; ++i) {
+            int a = rng() % routers, b = rng() % routers;
+            if (a != b) addEdge(nodes[a].name, nodes[b].name, latency(a, b));
+        }
+        endBatch();
+        setSilentMode(originalSilentMode);
+        if (!silentMode) cout << "Generated " << V << " routers and " << linkCount() << " links.\n";
     }
 
-    // Toggles the UP/DOWN status of a link
-    void toggleLink(const string& fromName, const string& toName, bool up) {
-        int u = getRouterIndex(fromName);
-        int v = getRouterIndex(toName);
-        if (u == -1 || v == -1) {
-            cout << "Invalid router names.\n";
+    // Times shortest-path trees from 'sources' random routers on the adjacency lists
+    // and on the snapshot under each router order, single-threaded so only memory
+    // locality differs. Distances are checked against the adjacency-list results.
+    void benchmarkRouterOrders(int sources) {
+        using Clock = chrono::steady_clock;
+        auto millis = [](Clock::duration d) { return chrono::duration<double, milli>(d).count(); };
+        vector<int> picks;
+        mt19937 rng(7);
+        for (int i = 0; V > 0 && i < 10 * sources && (int)picks.size() < sources; ++i) {
+            int r = rng() % V;
+            if (nodes[r].up) picks.push_back(r);
+        }
+        if (picks.empty()) {
+            cout << "No UP routers to benchmark.\n";
             return;
         }
-
-        bool changed = false;
-        // Update u -> v
-        for (auto* edge = nodes[u].head; edge; edge = edge->next) {
-            if (edge->dest == v) {
-                edge->cost = up ? edge->originalCost : INT_MAX; // Set cost to original or INT_MAX
-                edge->up = up;
-                changed = true;
-            }
+        vector<PathCost> expected;
+        Clock::time_point start = Clock::now();
+        for (int src : picks) {
+            DijkstraResult tree = runDijkstra(src);
+            expected.push_back(accumulate(tree.dist.begin(), tree.dist.end(), (PathCost)0,
+                [](PathCost sum, PathCost d) { return d == INF_COST ? sum : sum + d; }));
         }
-        // Update v -> u
-        for (auto* edge = nodes[v].head; edge; edge = edge->next) {
-            if (edge->dest == u) {
-                edge->cost = up ? edge->originalCost : INT_MAX;
-                edge->up = up;
-                changed = true;
+        double listMs = millis(Clock::now() - start) / picks.size();
+        cout << "Router order benchmark: " << V << " routers, " << linkCount() << " links, "
+             << picks.size() << " sources\n";
+        cout << "Layout\t\tBuild ms\tLink span\tms per tree\n";
+        cout << "lists\t\t-\t\t-\t\t" << listMs << "\n";
+
+        RouterOrder original = routerOrder;
+        const pair<RouterOrder, const char*> layouts[] = {
+            { RouterOrder::Insertion, "csr none\t" }, { RouterOrder::Bfs, "csr bfs\t\t" },
+            { RouterOrder::Rcm, "csr rcm\t\t" }, { RouterOrder::Partition, "csr partition\t" } };
+        for (const auto& layout : layouts) {
+            setRouterOrder(layout.first);
+            start = Clock::now();
+            shared_ptr<const CsrGraph> g = csrSnapshot();
+            double buildMs = millis(Clock::now() - start);
+            bool matches = true;
+            start = Clock::now();
+            for (size_t i = 0; i < picks.size(); ++i) {
+                DijkstraResult tree = csrDijkstra(*g, g->internalId(picks[i]));
+                PathCost sum = 0;
+                for (PathCost d : tree.dist) if (d != INF_COST) sum += d;
+                matches = matches && sum == expected[i];
             }
+            double treeMs = millis(Clock::now() - start) / picks.size();
+            cout << layout.second << buildMs << "\t\t" << averageLinkSpan(*g) << "\t\t" << treeMs
+                 << (matches ? "" : "\t(distance mismatch!)") << "\n";
         }
-        if (!changed) cout << "Link not found.\n";
-        else cout << "Link " << fromName << " <--> " << toName << " is now " << (up ? "UP" : "DOWN") << ".\n";
+        setRouterOrder(original);
     }
 
-private:
-    // Private helper function for Dijkstra's algorithm.
-    // Computes shortest distances and predecessors from a source router.
-    DijkstraResult runDijkstra(int src) {
-        vector<int> dist(V, INT_MAX);
-        vector<int> prev(V, -1);
-        vector<bool> visited(V, false);
+    // Selects the engine used to build routing trees; cached trees stay valid
+    void setSsspEngine(SsspEngine engine) {
+        ssspEngine = engine;
+    }
 
-        // Add bounds checking for src, though it should be handled by callers
-        if (src < 0 || src >= V) {
-            // Return an empty/invalid result if src is out of bounds
-            return { vector<int>(), vector<int>() };
+    // Answers a shortest, widest and/or hop-limited path query without touching shared
+    // state: results live in the caller's workspace, exclusions in the query's masks
+    RouteResult findRoute(int src, int dest, const RouteQuery& query, SearchWorkspace& ws) const {
+        if (src < 0 || src >= V || dest < 0 || dest >= V) {
+            return RouteResult(); // Invalid source or destination
         }
+        LinkFilter allowed{ nodes.data(), query.excludedRouters, query.excludedLinks };
+        if (!allowed.routerAllowed(src) || !allowed.routerAllowed(dest)) {
+            return RouteResult();
+        }
+        if (src != dest && !mayReach(src, dest)) {
+            return RouteResult(); // Different partitions; exclusions can only remove more
+        }
+        if (query.mode == RouteMode::Widest) {
+            return routeWith(src, dest, query, WidestCost{}, allowed, ws);
+        }
+        switch (routingMetric) {
+        case RoutingMetric::WeightedSum:   return routeWith(src, dest, query, WeightedSumCost{ metricWeights }, allowed, ws);
+        case RoutingMetric::Lexicographic: return routeWith(src, dest, query, LexicographicCost{}, allowed, ws);
+        default:                           return routeWith(src, dest, query, LatencyCost{}, allowed, ws);
+        }
+    }
 
-        dist[src] = 0;
-        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<>> pq; // Min-priority queue
-        pq.push({ 0, src });
-
-        while (!pq.empty()) {
-            int u = pq.top().second;
-            pq.pop();
-
-            // If already visited or router is down, skip
-            if (visited[u] || !nodes[u].up) continue;
-            visited[u] = true;
-
-            // FIX for C6385: Explicitly check dist[u] here before iterating neighbors
-            // If dist[u] is INT_MAX, it means 'u' is unreachable from source,
-            // so we shouldn't use it to find paths to its neighbors.
-            if (dist[u] == INT_MAX) {
-                continue;
+    // Parses "SRC DEST [widest] [hops=N] [avoid=R1,R2] [avoid-link=R1-R2,R3-R4]" into a query.
+    // The exclusion masks are filled in and referenced by 'query'.
+    bool parseRouteQuery(const string& text, int& src, int& dest, RouteQuery& query,
+                         vector<bool>& routerMask, vector<bool>& linkMask) {
+        istringstream in(text);
+        string srcName, destName, token;
+        if (!(in >> srcName >> destName)) {
+            cout << "Expected source and destination router names.\n";
+            return false;
+        }
+        src = getRouterIndex(srcName);
+        dest = getRouterIndex(destName);
+        if (src == -1 || dest == -1) {
+            cout << "Invalid router names.\n";
+            return false;
+        }
+        query = RouteQuery();
+        routerMask.assign(V, false);
+        linkMask.assign(linkIdLimit, false);
+        query.excludedRouters = &routerMask;
+        query.excludedLinks = &linkMask;
+
+        auto splitList = [](const string& list) {
+            vector<string> items;
+            stringstream ss(list);
+            string item;
+            while (getline(ss, item, ',')) {
+                if (!item.empty()) items.push_back(item);
             }
-
-            // Explore neighbors
-            for (EdgeNode* edge = nodes[u].head; edge; edge = edge->next) {
-                int v = edge->dest;
-                int cost = edge->cost;
-
-                // Check if neighbor is not visited, is up, link is up (cost != INT_MAX)
-                // and a shorter path is found.
-                // Addition is now safer as dist[u] is guaranteed not to be INT_MAX
-                long long new_dist = (long long)dist[u] + cost; // Use long long for safe addition
-
-                // Only update if new_dist is better than current dist[v]
-                if (!visited[v] && nodes[v].up && cost != INT_MAX && new_dist < dist[v]) {
-                    dist[v] = static_cast<int>(new_dist); // Cast back to int, assuming it fits
-                    prev[v] = u;
-                    pq.push({ dist[v], v });
+            return items;
+        };
+        while (in >> token) {
+            if (token == "widest") {
+                query.mode = RouteMode::Widest;
+            }
+            else if (token.rfind("hops=", 0) == 0) {
+                query.maxHops = atoi(token.c_str() + 5);
+                if (query.maxHops <= 0) {
+                    cout << "Hop limit must be positive.\n";
+                    return false;
+                }
+            }
+            else if (token.rfind("avoid=", 0) == 0) {
+                for (const string& name : splitList(token.substr(6))) {
+                    int idx = getRouterIndex(name);
+                    if (idx == -1) {
+                        cout << "Router " << name << " not found.\n";
+                        return false;
+                    }
+                    routerMask[idx] = true;
                 }
             }
+            else if (token.rfind("avoid-link=", 0) == 0) {
+                for (const string& link : splitList(token.substr(11))) {
+                    size_t dash = link.find('-');
+                    int u = dash == string::npos ? -1 : getRouterIndex(link.substr(0, dash));
+                    int v = dash == string::npos ? -1 : getRouterIndex(link.substr(dash + 1));
+                    EdgeNode* edge = (u == -1 || v == -1) ? nullptr : findEdge(u, v);
+                    if (!edge) {
+                        cout << "Link " << link << " not found.\n";
+                        return false;
+                    }
+                    linkMask[edge->linkId] = true;
+                }
+            }
+            else {
+                cout << "Unknown query option " << token << ".\n";
+                return false;
+            }
         }
-        return { dist, prev };
+        return true;
+    }
+
+    // Prints the result of a path query
+    void printRoute(const RouteResult& route, const RouteQuery& query) {
+        if (route.path.empty()) {
+            cout << "No route satisfies the query.\n";
+            return;
+        }
+        cout << "Route: ";
+        for (size_t i = 0; i < route.path.size(); ++i) {
+            cout << nodes[route.path[i]].name << (i + 1 < route.path.size() ? " -> " : "\n");
+        }
+        if (query.mode == RouteMode::Widest) {
+            if (route.path.size() == 1) cout << "Bottleneck: none (source is the destination)\n";
+            else cout << "Bottleneck: " << route.cost << " Mbps\n";
+        }
+        else cout << "Total Cost: " << route.cost << "\n";
+    }
+
+    // Prints hit/miss statistics of the route cache
+    void printCacheStats() {
+        const RouteCache::Stats& stats = routeCache.stats();
+        size_t lookups = stats.hits + stats.misses;
+        cout << "Route cache: " << routeCache.size() << " trees, " << routeCache.bytesUsed() << " bytes, "
+             << stats.hits << " hits, " << stats.misses << " misses";
+        if (lookups > 0) cout << " (" << (100.0 * stats.hits / lookups) << "% hit rate)";
+        cout << ", " << stats.evictions << " evictions\n";
     }
 
-public:
     // Finds and prints the shortest path and its cost between two routers
-    int dijkstra(int src, int dest, bool returnCostOnly = false) {
+    PathCost dijkstra(int src, int dest, bool returnCostOnly = false) {
         // Add bounds checking for src and dest
         if (src < 0 || src >= V || dest < 0 || dest >= V) {
             if (!silentMode) cout << "Invalid source or destination router index.\n";
-            return INT_MAX;
+            return INF_COST;
+        }
+        // Routers in different partitions: answer without searching
+        if (src != dest && !reachable(src, dest)) {
+            if (!returnCostOnly) cout << "No path from " << nodes[src].name << " to " << nodes[dest].name << ".\n";
+            return INF_COST;
         }
 
-        DijkstraResult result = runDijkstra(src);
-        const auto& dist = result.dist;
-        const auto& prev = result.prev;
+        shared_ptr<const DijkstraResult> result = shortestPathTree(src);
+        const auto& dist = result->dist;
+        const auto& prev = result->prev;
 
         // Handle case where runDijkstra returned empty vectors due to invalid src
         if (dist.empty() || prev.empty()) {
-            return INT_MAX;
+            return INF_COST;
         }
 
         if (returnCostOnly) {
             return dist[dest]; // Return only the cost
         }
 
-        if (dist[dest] == INT_MAX) {
+        if (dist[dest] == INF_COST) {
             cout << "No path from " << nodes[src].name << " to " << nodes[dest].name << ".\n";
-            return INT_MAX;
+            return INF_COST;
         }
 
         stack<int> pathStack;
@@ -363,11 +2933,11 @@ public:
             pathStack.push(current);
             current = prev[current];
         }
-        // If current is -1, it means path reconstruction failed (e.g., no path to src, but dist[dest] wasn't INT_MAX)
+        // If current is -1, it means path reconstruction failed (e.g., no path to src, but dist[dest] wasn't INF_COST)
         // This check ensures src is actually reachable and in the path.
         if (current == -1 && src != dest) { // Added src != dest check for the case when dest is src
             cout << "Error: Path reconstruction failed for " << nodes[src].name << " to " << nodes[dest].name << ".\n";
-            return INT_MAX;
+            return INF_COST;
         }
         pathStack.push(src); // Add source to the path
 
@@ -392,12 +2962,15 @@ public:
         if (src < 0 || src >= V || dest < 0 || dest >= V) {
             return vector<int>(); // Return empty path
         }
+        if (src != dest && !reachable(src, dest)) {
+            return vector<int>(); // Different partitions
+        }
 
-        DijkstraResult result = runDijkstra(src);
-        const auto& dist = result.dist;
-        const auto& prev = result.prev;
+        shared_ptr<const DijkstraResult> result = shortestPathTree(src);
+        const auto& dist = result->dist;
+        const auto& prev = result->prev;
 
-        if (dist.empty() || prev.empty() || dist[dest] == INT_MAX) {
+        if (dist.empty() || prev.empty() || dist[dest] == INF_COST) {
             return vector<int>(); // No path found or invalid source
         }
 
@@ -426,38 +2999,21 @@ public:
         if (src < 0 || src >= V || dest < 0 || dest >= V) {
             return -1; // Invalid source or destination
         }
+        if (src != dest && !reachable(src, dest)) {
+            return -1; // Different partitions
+        }
 
-        DijkstraResult result = runDijkstra(src);
-        const auto& dist = result.dist;
-        const auto& prev = result.prev;
+        shared_ptr<const DijkstraResult> result = shortestPathTree(src);
+        const auto& dist = result->dist;
 
-        if (dist.empty() || prev.empty() || dist[dest] == INT_MAX) {
+        if (dist.empty() || dist[dest] == INF_COST) {
             return -1; // No path
         }
         if (src == dest) {
             return src; // Next hop from a router to itself is itself
         }
-
-        // Trace back from dest to find the node directly connected to src
-        int current = dest;
-        // Keep tracing back until we find the node whose predecessor is 'src'
-        // or until we reach 'src' itself (meaning dest is directly connected).
-        while (prev[current] != src && prev[current] != -1 && current != src) {
-            current = prev[current];
-        }
-
-        // If we found a node whose predecessor is 'src', that node is the next hop.
-        if (prev[current] == src) {
-            return current;
-        }
-        // If 'current' is now 'dest' and prev[dest] is 'src', it means 'dest' is directly connected.
-        if (current == dest && prev[dest] == src) {
-            return dest; // Direct link, next hop is the destination itself
-        }
-
-        // This case should ideally not be hit if a path exists and src != dest
-        // It might happen if the path is found but the trace-back logic fails for some edge case.
-        return -1;
+        // The tree records the first hop of every path, so no trace-back is needed
+        return result->firstHop[dest];
     }
 
     // Prints the routing table for a given router
@@ -466,14 +3022,15 @@ public:
             cout << "Invalid router index.\n";
             return;
         }
+        shared_ptr<const DijkstraResult> tree = routingTableTree(routerIdx); // One tree for the whole table
         cout << "Routing Table for " << nodes[routerIdx].name << ":\n";
         cout << "Destination\tNext Hop\tCost\n";
         for (int dest = 0; dest < V; ++dest) {
             if (dest == routerIdx) continue; // Skip itself
-            int nextHop = getNextHop(routerIdx, dest);
-            int cost = dijkstra(routerIdx, dest, true); // Get cost only
+            int nextHop = tree->firstHop[dest];
+            PathCost cost = tree->dist[dest];
 
-            if (cost == INT_MAX) {
+            if (cost == INF_COST) {
                 cout << nodes[dest].name << "\t\t" << "-" << "\t\t" << "INF\n";
             }
             // FIX: Changed 'src' to 'routerIdx' as 'src' is not defined in this scope.
@@ -487,6 +3044,206 @@ public:
         }
     }
 
+    // Writes every router's routing table in one run. Tables are computed on all
+    // threads, each with its own search workspace (or read from the all-pairs matrix on
+    // dense topologies), formatted into large per-thread buffers and written with fwrite.
+    //   perRouter = false: one columnar file 'target' with a row per (source, destination)
+    //   perRouter = true:  one file per router, named target + router name + ".txt"
+    // With 'aggregate', destinations sharing a next hop are grouped on one line and
+    // costs are left out, as in a forwarding table.
+    void exportAllRoutingTables(const string& target, bool perRouter, bool aggregate, int threads = 0) {
+        shared_ptr<const DenseApsp> matrix;
+        if (denseApspSuitable()) {
+            matrix = allPairs();
+            if (!matrix->usable) matrix.reset();
+        }
+        shared_ptr<const CsrGraph> snapshot;
+        if (matrix || (routerOrder != RouterOrder::Insertion && routingMetric != RoutingMetric::Lexicographic)) {
+            snapshot = csrSnapshot(); // Matrix rows are turned into trees over the snapshot's links
+        }
+        switch (routingMetric) {
+        case RoutingMetric::WeightedSum:
+            exportTablesWith(WeightedSumCost{ metricWeights }, matrix, snapshot, target, perRouter, aggregate, threads);
+            break;
+        case RoutingMetric::Lexicographic:
+            exportTablesWith(LexicographicCost{}, matrix, snapshot, target, perRouter, aggregate, threads);
+            break;
+        default:
+            exportTablesWith(LatencyCost{}, matrix, snapshot, target, perRouter, aggregate, threads);
+            break;
+        }
+    }
+
+    template <class Cost>
+    void exportTablesWith(const Cost& policy, const shared_ptr<const DenseApsp>& matrix,
+                          const shared_ptr<const CsrGraph>& snapshot, const string& target,
+                          bool perRouter, bool aggregate, int threads) const {
+        using Dist = typename Cost::Dist;
+        using Clock = chrono::steady_clock;
+        Clock::time_point started = Clock::now();
+
+        FILE* columnar = nullptr;
+        mutex columnarLock;
+        atomic<size_t> rows(0), bytes(0);
+        if (!perRouter) {
+            columnar = fopen(target.c_str(), "wb");
+            if (!columnar) {
+                cout << "Failed to open " << target << " for writing.\n";
+                return;
+            }
+            const char* header = aggregate ? "source\tnext_hop\tdestinations\n" : "source\tdestination\tnext_hop\tcost\n";
+            fputs(header, columnar);
+            bytes += strlen(header);
+        }
+
+        atomic<int> nextSource(0);
+        atomic<bool> failed(false);
+        auto worker = [&] {
+            SearchWorkspace ws;
+            vector<PathCost> cost(V);
+            vector<int> hop(V), groupStart(V + 2), grouped(V);
+            string buffer;
+            buffer.reserve(EXPORT_BUFFER_BYTES + 4096);
+            FILE* out = nullptr;
+
+            auto appendCost = [&](PathCost c) {
+                char digits[24];
+                auto end = to_chars(digits, digits + sizeof(digits), c).ptr;
+                buffer.append(digits, end);
+            };
+            auto flush = [&] {
+                if (buffer.empty()) return;
+                if (perRouter) {
+                    if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size()) failed = true;
+                }
+                else {
+                    lock_guard<mutex> lock(columnarLock);
+                    if (fwrite(buffer.data(), 1, buffer.size(), columnar) != buffer.size()) failed = true;
+                }
+                bytes += buffer.size();
+                buffer.clear();
+            };
+            // Called after each complete line. A per-router file has one writer, so it can
+            // be written at any line; the shared file is only written whole tables at a
+            // time (below), so one source's rows stay together.
+            auto lineDone = [&] {
+                if (perRouter && buffer.size() >= EXPORT_BUFFER_BYTES) flush();
+            };
+
+            for (int src = nextSource++; src < V && !failed; src = nextSource++) {
+                // Costs and next hops from 'src' to every router
+                if (matrix) {
+                    DijkstraResult tree = matrix->tree(*snapshot, src);
+                    cost.swap(tree.dist);
+                    hop.swap(tree.firstHop);
+                }
+                else if (snapshot) {
+                    DijkstraResult tree = csrDijkstra(*snapshot, snapshot->internalId(src));
+                    snapshot->mapToExternal(tree);
+                    cost.swap(tree.dist);
+                    hop.swap(tree.firstHop);
+                }
+                else {
+                    SearchState<Dist>& state = ws.state<Dist>();
+                    searchShortest(src, -1, policy, UpFilter{ nodes.data() }, state);
+                    for (int j = 0; j < V; ++j) {
+                        cost[j] = state.dist[j] == Cost::infinity() ? INF_COST : Cost::report(state.dist[j]);
+                        hop[j] = state.firstHop[j];
+                    }
+                }
+
+                const string& source = nodes[src].name;
+                if (perRouter) {
+                    string filename = target + source + ".txt";
+                    out = fopen(filename.c_str(), "wb");
+                    if (!out) {
+                        failed = true;
+                        break;
+                    }
+                    buffer += "Routing Table for " + source + (aggregate ? " (grouped by next hop):\n" : ":\n");
+                    buffer += aggregate ? "Next Hop\tDestinations\n" : "Destination\tNext Hop\tCost\n";
+                }
+
+                if (aggregate) {
+                    // Counting sort of the destinations by next hop; key V = unreachable
+                    fill(groupStart.begin(), groupStart.end(), 0);
+                    auto key = [&](int dest) {
+                        return cost[dest] == INF_COST ? V : (hop[dest] == -1 ? dest : hop[dest]);
+                    };
+                    for (int dest = 0; dest < V; ++dest) {
+                        if (dest != src) ++groupStart[key(dest) + 1];
+                    }
+                    for (int k = 0; k <= V; ++k) groupStart[k + 1] += groupStart[k];
+                    for (int dest = 0; dest < V; ++dest) {
+                        if (dest != src) grouped[groupStart[key(dest)]++] = dest;
+                    }
+                    // groupStart[k] now marks the end of group k
+                    int begin = 0;
+                    for (int k = 0; k <= V; ++k) {
+                        int end = groupStart[k];
+                        if (begin == end) continue;
+                        if (!perRouter) buffer += source + '\t';
+                        buffer += k == V ? string("-") : nodes[k].name;
+                        buffer += '\t';
+                        for (int i = begin; i < end; ++i) {
+                            if (i > begin) buffer += ',';
+                            buffer += nodes[grouped[i]].name;
+                        }
+                        buffer += '\n';
+                        lineDone();
+                        ++rows;
+                        begin = end;
+                    }
+                }
+                else {
+                    for (int dest = 0; dest < V; ++dest) {
+                        if (dest == src) continue;
+                        if (!perRouter) buffer += source + '\t';
+                        buffer += nodes[dest].name;
+                        buffer += '\t';
+                        if (cost[dest] == INF_COST) {
+                            buffer += "-\tINF\n";
+                        }
+                        else {
+                            buffer += nodes[hop[dest] == -1 ? dest : hop[dest]].name; // Direct links have no separate hop
+                            buffer += '\t';
+                            appendCost(cost[dest]);
+                            buffer += '\n';
+                        }
+                        lineDone();
+                    }
+                    rows += max(V - 1, 0);
+                }
+
+                if (perRouter) {
+                    flush();
+                    if (fclose(out) != 0) failed = true;
+                    out = nullptr;
+                }
+                else if (buffer.size() >= EXPORT_BUFFER_BYTES) {
+                    flush();
+                }
+            }
+            if (!perRouter) flush();
+        };
+
+        threads = max(1, min(resolveThreadCount(threads), V));
+        vector<thread> workers;
+        for (int t = 1; t < threads; ++t) workers.emplace_back(worker);
+        worker();
+        for (thread& w : workers) w.join();
+        if (columnar && fclose(columnar) != 0) failed = true;
+
+        if (failed) {
+            cout << "Failed to write routing tables to " << target << ".\n";
+            return;
+        }
+        double seconds = chrono::duration<double>(Clock::now() - started).count();
+        cout << "Exported " << V << " routing tables (" << rows << " rows, " << bytes << " bytes) in "
+             << seconds << " s using " << threads << " thread(s)"
+             << (matrix ? " from the all-pairs matrix" : "") << ".\n";
+    }
+
     // Saves the current network topology to a file
     void saveToFile(const string& filename) {
         ofstream fout(filename);
@@ -494,7 +3251,12 @@ public:
             cout << "Failed to open file for writing.\n";
             return;
         }
+        writeTopology(fout);
+        cout << "Network topology saved to " << filename << ".\n";
+    }
 
+    // Writes the topology in the file format read by loadFromFile
+    void writeTopology(ostream& fout) {
         // Write number of routers
         fout << V << "\n";
         // Write router details (name, up status, position)
@@ -506,44 +3268,62 @@ public:
             for (EdgeNode* e = nodes[i].head; e; e = e->next) {
                 // Only write if 'i' is less than 'e->dest' to avoid duplicates (e.g., R0-R1 and R1-R0)
                 if (i < e->dest) {
-                    fout << nodes[i].name << " " << nodes[e->dest].name << " " << e->originalCost << "\n"; // Save original cost
+                    fout << nodes[i].name << " " << nodes[e->dest].name << " " << e->cost;
+                    // Bandwidth and loss columns are only written when set (or followed by the state)
+                    if (e->bandwidth != 0 || e->lossBp != 0 || !e->up) fout << " " << e->bandwidth << " " << e->lossBp;
+                    if (!e->up) fout << " down";
+                    fout << "\n";
                 }
             }
         }
-        cout << "Network topology saved to " << filename << ".\n";
     }
 
-    // Loads a network topology from a file
+    // Loads a network topology from a file. An open journal records the loaded
+    // topology as its new snapshot rather than as individual changes.
     void loadFromFile(const string& filename) {
         ifstream fin(filename);
         if (!fin) {
             cout << "Failed to open file for reading.\n";
             return;
         }
+        unique_ptr<ChangeJournal> active = move(journal);
+        bool loaded = readTopology(fin);
+        fin.close();
+        if (loaded) cout << "Network topology loaded from " << filename << ".\n";
+        if (!active) return;
+        if (loaded) {
+            journal = move(active);
+            compactJournal();
+            return;
+        }
+        // The partially read topology must not become the snapshot: reload the journaled one
+        string base = active->basePath();
+        active.reset();
+        cout << "Restoring the journaled topology.\n";
+        openJournal(base);
+    }
 
+    // Replaces the topology with one read in the saveToFile format
+    bool readTopology(istream& fin) {
         // Clear the current graph completely before loading new data
-        // Explicitly trigger destructor for each router's edges
-        for (int i = 0; i < V; ++i) {
-            clearEdges(i); // Ensures all EdgeNodes are deleted
-        }
-        V = 0; // Reset active router count
+        clearTopology();
 
         int n_routers;
         fin >> n_routers;
         if (fin.fail() || n_routers < 0) {
             cout << "Error reading number of routers from file. File might be corrupted or empty.\n";
-            fin.close();
-            return;
+            return false;
         }
         if (n_routers > MAX_V) {
             cout << "Error: Number of routers in file (" << n_routers << ") exceeds MAX_V (" << MAX_V << "). Aborting load.\n";
-            fin.close();
-            return;
+            return false;
         }
+        nodes.reserve(n_routers);
 
         // Temporarily set silent mode to prevent many console messages during load
         bool originalSilentMode = silentMode;
         setSilentMode(true);
+        beginBatch(); // Lay out once at the end instead of after every router
 
         // Read and add routers
         for (int i = 0; i < n_routers; ++i) {
@@ -553,28 +3333,54 @@ public:
             fin >> name >> upFlag >> x >> y;
             if (fin.fail()) {
                 cout << "Error reading router data for router " << i << ". Aborting load.\n";
+                endBatch();
                 setSilentMode(originalSilentMode);
-                fin.close();
-                return;
+                return false;
+            }
+            if (getRouterIndex(name) != -1) {
+                cout << "Error: duplicate router name " << name << " in file. Aborting load.\n";
+                endBatch();
+                setSilentMode(originalSilentMode);
+                return false;
             }
             addRouter(name); // This increments V and initializes the new router
-            nodes[i].up = (upFlag == 1);
-            nodes[i].x = x;
-            nodes[i].y = y;
+            int idx = getRouterIndex(name);
+            nodes[idx].up = (upFlag == 1);
+            nodes[idx].x = x;
+            nodes[idx].y = y;
         }
 
-        // Read and add edges
-        string from, to;
-        int cost;
-        while (fin >> from >> to >> cost) {
-            if (fin.fail()) break; // End of file or invalid data
-            addEdge(from, to, cost); // This adds the edge and sets up/down state based on cost
+        // Read and add edges: "from to cost [bandwidth loss [down]]"
+        string line;
+        while (getline(fin, line)) {
+            istringstream edgeIn(line);
+            string from, to, state;
+            int cost, bandwidth = 0, lossBp = 0;
+            if (!(edgeIn >> from >> to >> cost)) continue; // Blank line or invalid data
+            if (!(edgeIn >> bandwidth >> lossBp)) bandwidth = lossBp = 0;
+            addEdge(from, to, cost, bandwidth, lossBp);
+            if (edgeIn >> state && state == "down") toggleLink(from, to, false);
         }
 
         setSilentMode(originalSilentMode); // Restore original silent mode
-        cout << "Network topology loaded from " << filename << ".\n";
-        arrangePositions(); // Re-arrange positions in case old positions were bad
-        fin.close();
+        topologyChanged(true); // Re-arrange positions in case old positions were bad
+        endBatch();
+        return true;
+    }
+
+    // Removes every router and link
+    void clearTopology() {
+        // Explicitly trigger destructor for each router's edges
+        for (int i = 0; i < V; ++i) {
+            clearEdges(i); // Ensures all EdgeNodes are deleted
+        }
+        nodes.clear();
+        componentsValid = false;
+        V = 0; // Reset active router count
+        nameIndex.clear();
+        linkIdLimit = 0;
+        freeLinkIds.clear();
+        topologyChanged(true);
     }
 
     // Helper to clear all outgoing edges for a given router index
@@ -598,7 +3404,7 @@ public:
             for (EdgeNode* e = nodes[i].head; e; e = e->next) {
                 // Draw each link only once (e.g., R0-R1, not R1-R0)
                 // Also, only draw if the destination router is UP and the link itself is UP
-                if (i < e->dest && nodes[e->dest].up && e->cost != INT_MAX) {
+                if (i < e->dest && nodes[e->dest].up && e->up) {
                     Vertex line[] = {
                         Vertex(Vector2f(nodes[i].x, nodes[i].y), Color::Black),
                         Vertex(Vector2f(nodes[e->dest].x, nodes[e->dest].y), Color::Black)
@@ -664,14 +3470,15 @@ public:
             return;
         }
 
+        shared_ptr<const DijkstraResult> tree = routingTableTree(routerIdx); // One tree for the whole table
         fout << "Routing Table for " << nodes[routerIdx].name << ":\n";
         fout << "Destination\tNext Hop\tCost\n";
         for (int dest = 0; dest < V; ++dest) {
             if (dest == routerIdx) continue;
-            int nextHop = getNextHop(routerIdx, dest);
-            int cost = dijkstra(routerIdx, dest, true); // Get cost only
+            int nextHop = tree->firstHop[dest];
+            PathCost cost = tree->dist[dest];
 
-            if (cost == INT_MAX) fout << nodes[dest].name << "\t\t" << "-" << "\t\t" << "INF\n";
+            if (cost == INF_COST) fout << nodes[dest].name << "\t\t" << "-" << "\t\t" << "INF\n";
             // Corrected condition: nextHop is either -1 (no path/issue) or the destination itself (direct link)
             else if (nextHop == -1 || nextHop == dest) { // If nextHop is -1 or the destination itself (meaning direct link)
                 fout << nodes[dest].name << "\t\t" << nodes[dest].name << "\t\t" << cost << "\n"; // Direct link
@@ -696,13 +3503,155 @@ void printMenu() {
     cout << "7. Show Routing Table\n";
     cout << "8. Save Topology\n";
     cout << "9. Load Topology\n";
+    cout << "A. Apply Change Set File\n";
+    cout << "U. Undo Last Change Set\n";
+    cout << "M. Select Routing Metric\n";
+    cout << "Q. Constrained/Widest Path Query\n";
+    cout << "C. Connectivity Report\n";
+    cout << "B. Betweenness / Link Criticality Ranking\n";
+    cout << "O. Router Ordering for Searches\n";
+    cout << "T. Show All Routing Tables\n";
+    cout << "J. Open Change Journal\n";
+    cout << "E. Export All Routing Tables\n";
     cout << "0. Exit\n";
     cout << "-----------------------------------\n";
     cout << "Click routers in window to select source and destination for shortest path visualization.\n";
     cout << "Enter your choice: ";
 }
 
-int main() {
+// Runs without a window: processes the command-line options in order and exits.
+//   --load FILE     load a topology
+//   --apply FILE    apply a change-set file as one transaction
+//   --metric SPEC   select the routing metric: latency, lexicographic or weighted:L,B,P
+//   --table ROUTER  print a router's routing table
+//   --engine NAME   shortest-path engine for routing trees: auto, dijkstra, delta or dense
+//   --all-tables    print every router's routing table
+//   --aggregate     group destinations by next hop in later bulk exports
+//   --export-all F  write every routing table to one columnar file F
+//   --export-each P write every routing table to its own file, P + router name + ".txt"
+//   --journal BASE  recover BASE.snap + BASE.journal and record every later change
+//   --compact       fold the open journal into a new snapshot
+//   --replay FILE   replay a journal at full speed, routing after every change
+//   --betweenness N rank routers and links by betweenness from N sampled sources (0 = exact)
+//   --order NAME    router numbering of the search snapshot: none, bfs, rcm or partition
+//   --generate N    replace the topology with a synthetic N-router backbone
+//   --bench-order K time trees from K sources under every router order
+//   --route QUERY   run a path query, e.g. "R0 R4 widest hops=3 avoid=R2 avoid-link=R1-R3"
+//   --save FILE     save the topology
+//   --cache-stats   print route cache statistics
+//   --report        print components, bridges and articulation points
+int runHeadless(int argc, char* argv[]) {
+    Graph graph;
+    bool aggregateExports = false;
+    for (int i = 2; i < argc; ++i) {
+        string option = argv[i];
+        if (option == "--cache-stats") {
+            graph.printCacheStats();
+            continue;
+        }
+        if (option == "--report") {
+            graph.printConnectivityReport();
+            continue;
+        }
+        if (option == "--all-tables") {
+            graph.printAllRoutingTables();
+            continue;
+        }
+        if (option == "--aggregate") {
+            aggregateExports = true;
+            continue;
+        }
+        if (option == "--compact") {
+            if (!graph.journal) cout << "No journal is open.\n";
+            else if (graph.compactJournal()) cout << "Journal compacted.\n";
+            else return 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cout << "Missing argument for " << option << ".\n";
+            return 1;
+        }
+        string arg = argv[++i];
+        if (option == "--load") {
+            graph.loadFromFile(arg);
+        }
+        else if (option == "--apply") {
+            ChangeSet changes;
+            if (!loadChangeSet(arg, changes) || !graph.applyChangeSet(changes)) return 1;
+        }
+        else if (option == "--metric") {
+            RoutingMetric metric;
+            MetricWeights weights;
+            if (!parseRoutingMetric(arg, metric, weights)) {
+                cout << "Invalid routing metric " << arg << " (weights must be 0-" << MAX_METRIC_WEIGHT << ").\n";
+                return 1;
+            }
+            graph.setRoutingMetric(metric, weights);
+        }
+        else if (option == "--route") {
+            int src, dest;
+            RouteQuery query;
+            vector<bool> routerMask, linkMask;
+            if (!graph.parseRouteQuery(arg, src, dest, query, routerMask, linkMask)) return 1;
+            graph.printRoute(graph.findRoute(src, dest, query, graph.workspace), query);
+        }
+        else if (option == "--engine") {
+            if (arg == "auto") graph.setSsspEngine(SsspEngine::Auto);
+            else if (arg == "dijkstra") graph.setSsspEngine(SsspEngine::Dijkstra);
+            else if (arg == "delta") graph.setSsspEngine(SsspEngine::DeltaStepping);
+            else if (arg == "dense") graph.setSsspEngine(SsspEngine::DenseApsp);
+            else {
+                cout << "Unknown engine " << arg << ".\n";
+                return 1;
+            }
+        }
+        else if (option == "--export-all" || option == "--export-each") {
+            graph.exportAllRoutingTables(arg, option == "--export-each", aggregateExports, graph.ssspThreads);
+        }
+        else if (option == "--journal") {
+            if (!graph.openJournal(arg)) return 1;
+        }
+        else if (option == "--replay") {
+            graph.benchmarkReplay(arg);
+        }
+        else if (option == "--order") {
+            RouterOrder order;
+            if (!parseRouterOrder(arg, order)) {
+                cout << "Unknown router order " << arg << ".\n";
+                return 1;
+            }
+            graph.setRouterOrder(order);
+        }
+        else if (option == "--generate") {
+            graph.generateTopology(atoi(arg.c_str()));
+        }
+        else if (option == "--bench-order") {
+            graph.benchmarkRouterOrders(max(atoi(arg.c_str()), 1));
+        }
+        else if (option == "--betweenness") {
+            graph.printCriticalityRanking(graph.computeBetweenness(max(atoi(arg.c_str()), 0), graph.ssspThreads));
+        }
+        else if (option == "--table") {
+            int idx = graph.getRouterIndex(arg);
+            if (idx == -1) cout << "Router not found.\n";
+            else graph.printRoutingTable(idx);
+        }
+        else if (option == "--save") {
+            graph.saveToFile(arg);
+        }
+        else {
+            cout << "Unknown option " << option << ".\n";
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--headless") {
+        return runHeadless(argc, argv);
+    }
+
     cout << "WELCOME TO THE NETWORK ROUTE EXPLORER PROGRAM\n";
     cout << "--------------------------------------------------\n";
     cout << "This program allows you to visualize packet routing in a network of routers.\n";
@@ -761,6 +3710,8 @@ int main() {
     int selectedSource = -1; // Index of the currently selected source router
     int selectedDest = -1;   // Index of the currently selected destination router
     vector<int> shortestPath; // Stores the indices of routers in the shortest path
+    ChangeSet lastUndo;       // Restores the topology from before the last applied change set
+    unsigned long long undoVersion = 0; // Topology version lastUndo was computed against
 
     // Main SFML window loop
     while (window.isOpen()) {
@@ -930,13 +3881,131 @@ int main() {
                 shortestPath.clear();
                 break;
             }
+            case 'a':
+            case 'A': {
+                string filename;
+                cout << "Enter change set filename (e.g., changes.txt): ";
+                getline(cin, filename);
+                ChangeSet changes;
+                if (loadChangeSet(filename, changes) && graph.applyChangeSet(changes, &lastUndo)) {
+                    undoVersion = graph.topologyVersion;
+                }
+                selectedSource = selectedDest = -1;
+                shortestPath.clear();
+                break;
+            }
+            case 'm':
+            case 'M': {
+                string text;
+                cout << "Enter metric (latency, lexicographic, or weighted <latency> <bandwidth> <loss>): ";
+                getline(cin, text);
+                RoutingMetric metric;
+                MetricWeights weights;
+                if (!parseRoutingMetric(text, metric, weights)) {
+                    cout << "Invalid routing metric (weights must be 0-" << MAX_METRIC_WEIGHT << ").\n";
+                }
+                else {
+                    graph.setRoutingMetric(metric, weights);
+                    cout << "Routing metric set to " << text << ".\n";
+                }
+                shortestPath.clear();
+                break;
+            }
+            case 'q':
+            case 'Q': {
+                string text;
+                cout << "Enter query: SRC DEST [widest] [hops=N] [avoid=R1,R2] [avoid-link=R1-R2,...]: ";
+                getline(cin, text);
+                int src, dest;
+                RouteQuery query;
+                vector<bool> routerMask, linkMask;
+                if (graph.parseRouteQuery(text, src, dest, query, routerMask, linkMask)) {
+                    RouteResult route = graph.findRoute(src, dest, query, graph.workspace);
+                    graph.printRoute(route, query);
+                    selectedSource = src;
+                    selectedDest = dest;
+                    shortestPath = route.path; // Highlight the route in the window
+                }
+                break;
+            }
+            case 'b':
+            case 'B': {
+                string text;
+                cout << "Enter number of sampled sources (or press Enter for the exact computation): ";
+                getline(cin, text);
+                int samples = text.empty() ? 0 : atoi(text.c_str());
+                graph.printCriticalityRanking(graph.computeBetweenness(max(samples, 0), graph.ssspThreads));
+                break;
+            }
+            case 'e':
+            case 'E': {
+                string target, layout, grouping;
+                cout << "Write (1) one columnar file or (2) one file per router? ";
+                getline(cin, layout);
+                cout << (layout == "2" ? "Enter file name prefix (e.g., tables/): " : "Enter filename (e.g., tables.tsv): ");
+                getline(cin, target);
+                cout << "Group destinations by next hop? (y/n): ";
+                getline(cin, grouping);
+                graph.exportAllRoutingTables(target, layout == "2", grouping == "y" || grouping == "Y", graph.ssspThreads);
+                break;
+            }
+            case 'j':
+            case 'J': {
+                string base;
+                cout << "Enter journal base path (e.g., network): ";
+                getline(cin, base);
+                graph.openJournal(base);
+                selectedSource = -1;
+                selectedDest = -1;
+                shortestPath.clear();
+                break;
+            }
+            case 't':
+            case 'T':
+                graph.printAllRoutingTables();
+                break;
+            case 'o':
+            case 'O': {
+                string text;
+                cout << "Enter router order (none, bfs, rcm or partition): ";
+                getline(cin, text);
+                RouterOrder order;
+                if (parseRouterOrder(text, order)) {
+                    graph.setRouterOrder(order);
+                    cout << "Router order set to " << text << ".\n";
+                }
+                else cout << "Unknown router order.\n";
+                break;
+            }
+            case 'c':
+            case 'C': {
+                graph.printConnectivityReport();
+                break;
+            }
+            case 'u':
+            case 'U': {
+                if (lastUndo.empty()) {
+                    cout << "No change set to undo.\n";
+                }
+                else if (graph.topologyVersion != undoVersion) {
+                    // The inverse only applies to the topology the change set produced
+                    cout << "The topology has changed since the last change set; it can no longer be undone.\n";
+                    lastUndo.clear();
+                }
+                else if (graph.applyChangeSet(lastUndo)) {
+                    lastUndo.clear();
+                }
+                selectedSource = selectedDest = -1;
+                shortestPath.clear();
+                break;
+            }
             case '0': {
                 window.close(); // Close SFML window
                 cout << "Exiting program. Goodbye!\n";
                 break;
             }
             default:
-                cout << "Invalid option. Please choose from the menu (1-9 or 0 to exit).\n";
+                cout << "Invalid option. Please choose from the menu (1-9, A, U, M, Q, C, B, O, T, J, E or 0 to exit).\n";
                 break;
             }
             if (window.isOpen()) {